@@ -0,0 +1,43 @@
+#include "aot.h"
+#include <cstring>
+
+static AotProgram* programs = nullptr;
+
+void aotRegister(AotProgram& p){
+    p.next = programs;
+    programs = &p;
+}
+
+const AotProgram* aotFind(const chip8& c){
+    for(const AotProgram* p = programs; p; p = p->next){
+        if(p->variant == c.variant && p->romSize <= sizeof(c.memory) - startLocation &&
+           memcmp(c.memory + startLocation, p->rom, p->romSize) == 0)
+            return p;
+    }
+    return nullptr;
+}
+
+bool aotCodeModified(const chip8& c, const uint64_t* codeMap, const uint8_t* rom){
+    for(int page=0;page<64;page++){
+        if(!((c.dirtyPages >> page) & 1) || codeMap[page] == 0)
+            continue;
+        for(int bit=0;bit<64;bit++){
+            int a = page * 64 + bit;
+            if(((codeMap[page] >> bit) & 1) && c.memory[a] != rom[a - startLocation])
+                return true;
+        }
+    }
+    return false;
+}
+
+void aotRun(const AotProgram& p, chip8& c, uint64_t n){
+    uint64_t done = 0;
+    while(done < n){
+        done += p.run(c, n - done);
+        // whatever stopped the compiled code gets one interpreted instruction
+        if(done < n){
+            c.emulateCycle();
+            ++done;
+        }
+    }
+}
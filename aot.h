@@ -0,0 +1,85 @@
+#ifndef CHIP8_AOT_H
+#define CHIP8_AOT_H
+
+// Runtime side of the ahead of time recompiler (chip8aot.cpp)
+//
+// chip8aot turns a ROM into a C++ file with one function that runs the
+// game natively against a chip8. Linking that file in registers the program,
+// aotFind() picks it back up for a chip8 that has the same ROM loaded and
+// aotRun() runs it, handing control to emulateCycle() for anything the
+// compiled code does not cover (computed jumps to addresses it never saw,
+// code the ROM wrote over at run time, code outside the ROM image).
+#include <cstdint>
+#include <cstddef>
+#include "chip8.h"
+
+struct AotProgram{
+    const char* name;
+    const uint8_t* rom;
+    size_t romSize;
+    chip8::Variant variant; // the quirks the code was compiled with
+    // runs at most n instructions starting at c.pc, returns how many ran
+    // natively, leaves c.pc on the instruction it could not run
+    uint64_t (*run)(chip8& c, uint64_t n);
+    AotProgram* next;
+};
+
+// Adds p to the list aotFind() searches, generated files do this from a
+// static AotRegistrar
+void aotRegister(AotProgram& p);
+
+struct AotRegistrar{
+    explicit AotRegistrar(AotProgram& p){ aotRegister(p); }
+};
+
+// Compiled program whose ROM is what c has loaded at startLocation, built
+// for c's variant, or nullptr
+const AotProgram* aotFind(const chip8& c);
+
+// Runs n instructions of c, natively where p covers them
+void aotRun(const AotProgram& p, chip8& c, uint64_t n);
+
+// True when any byte marked in codeMap (one bit per address, 64 words) differs
+// from rom. Only pages in c.dirtyPages are looked at, so this is nearly free
+// for a ROM that never writes where its code is
+bool aotCodeModified(const chip8& c, const uint64_t* codeMap, const uint8_t* rom);
+
+// the bytes at addr are still the ones the code was compiled from
+inline bool aotSame(const chip8& c, uint16_t addr, uint16_t op){
+    return c.memory[addr] == (op >> 8) && c.memory[addr + 1] == (op & 0xFF);
+}
+
+// Pieces of the generated run() function. It keeps `done` (instructions run),
+// `synced` (how many of those went through retire() already) and `checked`
+// (compare every instruction against memory, set once the ROM has written
+// over its own code) as locals and leaves through the `out` label.
+
+// One compiled instruction with its operands as constants, stops when the
+// budget is spent or the bytes changed under it
+#define CHIP8_AOT_STEP(addr, op, handler) \
+    if(done == n || (checked && !aotSame(c, addr, op))){ c.pc = addr; goto out; } \
+    c.handler(chip8::makeInstr(op)); \
+    ++done;
+
+// Same for the instructions that look at or change pc
+#define CHIP8_AOT_STEP_PC(addr, op, handler) \
+    if(done == n || (checked && !aotSame(c, addr, op))){ c.pc = addr; goto out; } \
+    c.pc = addr + 2; \
+    c.handler(chip8::makeInstr(op)); \
+    ++done;
+
+// Timers are only brought up to date before an instruction that reads or
+// sets them and on the way out, retire(n) gives the same result as n retire()
+#define CHIP8_AOT_SYNC() \
+    c.retire(done - synced); \
+    synced = done;
+
+// After op_Fx33/op_Fx55, switch to checked mode if code got written over
+#define CHIP8_AOT_WROTE() \
+    if(!checked) \
+        checked = aotCodeModified(c, codeMap, rom);
+
+// Leave with pc at addr
+#define CHIP8_AOT_EXIT(addr) { c.pc = addr; goto out; }
+
+#endif
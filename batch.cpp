@@ -0,0 +1,129 @@
+#include "batch.h"
+#include "pool.h"
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+void runJob(chip8& c, const BatchJob& job, chip8::Engine engine, BatchResult& result){
+    if(job.image)
+        c = *job.image;
+    else
+        c.loadProgram(job.rom, job.romSize);
+    c.timerPeriod = job.timerPeriod ? job.timerPeriod : 1;
+    c.variant = job.variant;
+    c.seed(job.seed);
+
+    auto run = [&](uint64_t n){ c.run(n, engine); };
+    result.looped = false;
+    const uint64_t lastInput = job.input.empty() ? 0 : job.input.back().cycle;
+    if(!job.stopOnLoop || lastInput >= job.cycles)
+        runInput(c, job.input, job.cycles, run);
+    else{
+        runInput(c, job.input, lastInput, run);
+        // runInput stops short of the events due at lastInput itself, the
+        // keypad ends up the same replaying them all in order
+        for(const InputEvent& e : job.input)
+            c.keypad[e.key & 0xF] = e.down;
+
+        // Brent's cycle detection on states taken every interval
+        // instructions: nothing changes the instance from outside any more,
+        // so a state seen again means it repeats from there on. Only one
+        // earlier state is kept, moved further back each time the distance
+        // to it doubles, so a loop is caught within a few times its length
+        uint64_t mark = c.rollingHash();
+        uint64_t power = 1, steps = 0;
+        while(c.cycles < job.cycles){
+            c.run(std::min<uint64_t>(CHIP8_LOOP_CHECK_INTERVAL, job.cycles - c.cycles), engine);
+            uint64_t h = c.rollingHash();
+            if(h == mark){
+                result.looped = c.cycles < job.cycles;
+                break;
+            }
+            if(++steps == power){
+                mark = h;
+                power *= 2;
+                steps = 0;
+            }
+        }
+    }
+
+    result.hash = c.hashState();
+    result.rolling = c.rollingHash();
+    result.cycles = c.cycles;
+    memcpy(result.gfx, c.gfx, sizeof(result.gfx));
+}
+
+namespace {
+
+// One per thread, the owner takes from the back and thieves from the front.
+// Jobs are whole runs so a plain mutex is nowhere near the bottleneck
+struct WorkQueue{
+    std::mutex lock;
+    std::deque<size_t> jobs;
+};
+
+bool popBack(WorkQueue& q, size_t& job){
+    std::lock_guard<std::mutex> guard(q.lock);
+    if(q.jobs.empty())
+        return false;
+    job = q.jobs.back();
+    q.jobs.pop_back();
+    return true;
+}
+
+bool popFront(WorkQueue& q, size_t& job){
+    std::lock_guard<std::mutex> guard(q.lock);
+    if(q.jobs.empty())
+        return false;
+    job = q.jobs.front();
+    q.jobs.pop_front();
+    return true;
+}
+
+}
+
+std::vector<BatchResult> runBatch(const std::vector<BatchJob>& jobs, unsigned threads, chip8::Engine engine){
+    std::vector<BatchResult> results(jobs.size());
+    if(threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = std::min<size_t>(threads, std::max<size_t>(jobs.size(), 1));
+
+    std::unique_ptr<WorkQueue[]> queues(new WorkQueue[threads]);
+    for(size_t i=0;i<jobs.size();i++)
+        queues[i % threads].jobs.push_back(i);
+
+    // one instance per thread, reset with a copy of a blank one between jobs
+    // or overwritten with the job's image
+    InstancePool instancePool(threads);
+    std::vector<chip8*> instances;
+    for(unsigned t=0;t<threads;t++)
+        instances.push_back(instancePool.acquire());
+
+    auto worker = [&](unsigned self){
+        chip8* c = instances[self];
+        size_t job;
+        for(;;){
+            bool found = popBack(queues[self], job);
+            // own deque empty, steal from the others, nothing is added once
+            // running so a full pass with no luck means everything is taken
+            for(unsigned i=1;i<threads && !found;i++)
+                found = popFront(queues[(self + i) % threads], job);
+            if(!found)
+                return;
+
+            if(!jobs[job].image)
+                instancePool.reset(*c);
+            runJob(*c, jobs[job], engine, results[job]);
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for(unsigned t=1;t<threads;t++)
+        pool.emplace_back(worker, t);
+    worker(0);
+    for(std::thread& t : pool)
+        t.join();
+    return results;
+}
@@ -0,0 +1,51 @@
+#ifndef CHIP8_BATCH_H
+#define CHIP8_BATCH_H
+
+// Batch executor for regression and fuzz corpora
+//
+// runBatch() runs every job on its own chip8 instance across a pool of
+// threads. Jobs are dealt out round robin to per thread deques, a thread
+// works its own deque from the back and steals from the front of the
+// others once it runs dry, so long jobs do not leave threads idle.
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include "chip8.h"
+#include "inputlog.h"
+
+struct BatchJob{
+    const uint8_t* rom; // not owned, has to outlive runBatch()
+    size_t romSize;
+    std::vector<InputEvent> input; // sorted by cycle
+    uint64_t cycles;
+    uint32_t timerPeriod; // instructions per timer tick, see chip8::timerPeriod
+    uint32_t seed; // see chip8::seed()
+    chip8::Variant variant;
+    // optional, an instance with the ROM already loaded and decoded (a
+    // RomEntry image) that runs start as a copy of instead of loading rom
+    const chip8* image;
+    // stop once the instance is back in a state it was in after the last
+    // input event, it would only go round the same loop until cycles
+    bool stopOnLoop;
+};
+
+struct BatchResult{
+    uint64_t hash; // chip8::hashState() at the end
+    uint64_t rolling; // chip8::rollingHash() at the end, cheaper to compare jobs on
+    uint64_t cycles;
+    bool looped; // stopped early by stopOnLoop
+    uint64_t gfx[screen_height];
+};
+
+// Runs jobs on threads threads (0 picks the core count), results[i] belongs to jobs[i]
+std::vector<BatchResult> runBatch(const std::vector<BatchJob>& jobs, unsigned threads = 0,
+                                  chip8::Engine engine = CHIP8_DEFAULT_ENGINE);
+
+// how often a stopOnLoop job looks at its state hash, in instructions
+#define CHIP8_LOOP_CHECK_INTERVAL 1024
+
+// Runs a single job on c, which has to be freshly constructed or reset by an
+// InstancePool unless the job brings an image
+void runJob(chip8& c, const BatchJob& job, chip8::Engine engine, BatchResult& result);
+
+#endif
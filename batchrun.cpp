@@ -0,0 +1,182 @@
+// Runs a list of jobs across all cores and prints the final state of each
+//
+// usage: batchrun [-j threads] [-e engine] [-ipf n] [-seed n] [-variant v] [-loops] [-dedupe] [-fb] <jobfile>
+// every job file line is "rom cycles [input]", # starts a comment, input is
+// a text input script or a binary input log (which brings its own seed,
+// timer period and variant). rom can also be a directory, the line then stands for one
+// job per ROM in it. Prints "index hash cycles rom" per job, -fb adds the
+// final framebuffer as 32 rows of hex
+// -loops stops a job that comes back to a state it was in after its last
+// input event (a hang, a game over screen), its line ends in "loop"
+// -dedupe prints "index = first rom" for a job ending in the same state as
+// an earlier one and counts the distinct results
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <iterator>
+#include <unordered_map>
+#include <sstream>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include "chip8.h"
+#include "batch.h"
+#include "romlib.h"
+
+static void usage(const char* name){
+    std::cerr << "usage: " << name << " [-j threads] [-e table|switch|threaded|specialized] [-ipf n] [-seed n] [-variant modern|cosmac|schip|xochip] [-loops] [-dedupe] [-fb] <jobfile>" << std::endl;
+}
+
+static bool parseEngine(const char* name, chip8::Engine& engine){
+    if(!strcmp(name,"table")) engine = chip8::Engine::Table;
+    else if(!strcmp(name,"switch")) engine = chip8::Engine::Switch;
+    else if(!strcmp(name,"threaded")) engine = chip8::Engine::Threaded;
+    else if(!strcmp(name,"specialized")) engine = chip8::Engine::Specialized;
+    else return false;
+    return true;
+}
+
+int main(int argc, char* argv[]){
+    unsigned threads = 0;
+    chip8::Engine engine = CHIP8_DEFAULT_ENGINE;
+    uint32_t ipf = 1;
+    uint32_t seed = 0;
+    chip8::Variant variant = chip8::Variant::Modern;
+    bool printGfx = false;
+    bool stopOnLoop = false;
+    bool dedupe = false;
+    const char* jobFile = nullptr;
+
+    for(int i=1;i<argc;i++){
+        if(!strcmp(argv[i],"-j") && i+1 < argc)
+            threads = atoi(argv[++i]);
+        else if(!strcmp(argv[i],"-e") && i+1 < argc && parseEngine(argv[i+1],engine))
+            i++;
+        else if(!strcmp(argv[i],"-ipf") && i+1 < argc)
+            ipf = strtoul(argv[++i],NULL,0);
+        else if(!strcmp(argv[i],"-seed") && i+1 < argc)
+            seed = strtoul(argv[++i],NULL,0);
+        else if(!strcmp(argv[i],"-variant") && i+1 < argc && chip8_parseVariant(argv[i+1],variant))
+            i++;
+        else if(!strcmp(argv[i],"-loops"))
+            stopOnLoop = true;
+        else if(!strcmp(argv[i],"-dedupe"))
+            dedupe = true;
+        else if(!strcmp(argv[i],"-fb"))
+            printGfx = true;
+        else if(!jobFile && argv[i][0] != '-')
+            jobFile = argv[i];
+        else{
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if(!jobFile){
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::ifstream list(jobFile);
+    if(!list){
+        std::cerr << "could not open " << jobFile << std::endl;
+        return 1;
+    }
+
+    // every ROM is read and decoded once however many jobs use it
+    RomLibrary library;
+    std::vector<std::string> names;
+    std::vector<BatchJob> jobs;
+    std::string line;
+    for(int number=1;std::getline(list,line);number++){
+        line = line.substr(0, line.find('#'));
+        std::istringstream in(line);
+        std::string rom, script;
+        unsigned long long cycles;
+        if(!(in >> rom))
+            continue;
+        if(!(in >> cycles)){
+            std::cerr << jobFile << ":" << number << ": expected \"rom cycles [input]\"" << std::endl;
+            return 1;
+        }
+        in >> script;
+
+        std::string error;
+        std::vector<std::string> paths;
+        if(!isDirectory(rom.c_str()))
+            paths.push_back(rom);
+        else if(!listRoms(rom.c_str(), paths, error)){
+            std::cerr << error << std::endl;
+            return 1;
+        }
+
+        BatchJob job;
+        job.cycles = cycles;
+        job.timerPeriod = ipf;
+        job.seed = seed;
+        job.variant = variant;
+        job.image = nullptr;
+        job.stopOnLoop = stopOnLoop;
+        InputLog log;
+        if(!script.empty() && loadInputLog(script.c_str(), log, error)){
+            job.input = log.events;
+            job.timerPeriod = log.timerPeriod;
+            job.seed = log.seed;
+            job.variant = log.variant;
+        }
+        else if(!script.empty() && !loadInputScript(script.c_str(), job.input, error)){
+            std::cerr << error << std::endl;
+            return 1;
+        }
+        for(const std::string& path : paths){
+            const RomEntry* e = library.load(path.c_str(), error);
+            if(!e){
+                std::cerr << error << std::endl;
+                return 1;
+            }
+            job.rom = e->data.data();
+            job.romSize = e->data.size();
+            job.image = e->image;
+            jobs.push_back(job);
+            names.push_back(path);
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<BatchResult> results = runBatch(jobs, threads, engine);
+    auto end = std::chrono::steady_clock::now();
+
+    uint64_t total = 0;
+    size_t looped = 0;
+    // first job to end in each state, by rolling hash
+    std::unordered_map<uint64_t, size_t> firstWith;
+    for(size_t i=0;i<results.size();i++){
+        const BatchResult& r = results[i];
+        total += r.cycles;
+        looped += r.looped;
+        if(dedupe){
+            auto seen = firstWith.emplace(r.rolling, i);
+            if(!seen.second){
+                std::cout << i << " = " << seen.first->second << " " << names[i] << std::endl;
+                continue;
+            }
+        }
+        std::cout << i << " " << std::hex << std::setw(16) << std::setfill('0') << r.hash << std::dec << std::setfill(' ')
+                  << " " << r.cycles << " " << names[i] << (r.looped ? " loop" : "") << std::endl;
+        if(printGfx){
+            for(int row=0;row<screen_height;row++)
+                std::cout << "  " << std::hex << std::setw(16) << std::setfill('0') << r.gfx[row] << std::dec << std::setfill(' ') << std::endl;
+        }
+    }
+
+    double seconds = std::chrono::duration<double>(end - start).count();
+    std::cerr << jobs.size() << " jobs, " << library.size() << " ROMs (" << library.filesRead() << " files read), " << total << " cycles in " << seconds << " s ("
+              << (seconds > 0 ? total / seconds / 1e6 : 0) << " MIPS)" << std::endl;
+    if(stopOnLoop)
+        std::cerr << looped << " jobs stopped in a loop" << std::endl;
+    if(dedupe)
+        std::cerr << firstWith.size() << " distinct results" << std::endl;
+    return 0;
+}
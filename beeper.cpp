@@ -0,0 +1,99 @@
+#include "beeper.h"
+#include <cstring>
+
+// square wave pitch and volume
+static const int toneHz = 440;
+static const int16_t amplitude = 3000;
+
+Beeper::Beeper(size_t queueFrames)
+    : underruns(0), overflows(0), skipped(0), latencySamples(0), maxLatencySamples(0),
+      ring(queueFrames < 2 ? 2 : queueFrames), device(0), rate(48000), deviceSamples(512),
+      samplesPerFrame(800), started(false), on(false), left(0), phase(0){
+}
+
+Beeper::~Beeper(){
+    close();
+}
+
+bool Beeper::open(int samples, int sampleRate){
+    SDL_AudioSpec want, have;
+    memset(&want,0,sizeof(want));
+    want.freq = sampleRate;
+    want.format = AUDIO_S16SYS;
+    want.channels = 1;
+    want.samples = samples;
+    want.callback = callback;
+    want.userdata = this;
+
+    device = SDL_OpenAudioDevice(NULL, 0, &want, &have, 0);
+    if(device == 0)
+        return false;
+    rate = have.freq;
+    deviceSamples = have.samples;
+    samplesPerFrame = rate / 60;
+    SDL_PauseAudioDevice(device, 0);
+    return true;
+}
+
+void Beeper::close(){
+    if(device){
+        SDL_CloseAudioDevice(device);
+        device = 0;
+    }
+}
+
+void Beeper::push(bool state){
+    if(!ring.push(state))
+        ++overflows;
+}
+
+double Beeper::latencyMs() const{
+    return latencySamples * 1000.0 / rate;
+}
+
+double Beeper::maxLatencyMs() const{
+    return maxLatencySamples * 1000.0 / rate;
+}
+
+void Beeper::callback(void* userdata, Uint8* stream, int len){
+    ((Beeper*)userdata)->fill((int16_t*)stream, len / sizeof(int16_t));
+}
+
+void Beeper::fill(int16_t* out, int samples){
+    // (re)start only once half the queue is there so one late frame does
+    // not turn straight into another underrun
+    if(!started){
+        if(ring.size() < ring.capacity() / 2){
+            memset(out, 0, samples * sizeof(int16_t));
+            return;
+        }
+        started = true;
+    }
+    // the emulation clock and the audio clock drift apart, drop a frame
+    // when the queue runs well over half so latency stays bounded
+    uint8_t state;
+    if(ring.size() > ring.capacity() * 3 / 4 && ring.pop(state))
+        ++skipped;
+
+    uint32_t latency = ring.size() * samplesPerFrame + left + deviceSamples;
+    latencySamples = latency;
+    if(latency > maxLatencySamples)
+        maxLatencySamples = latency;
+
+    const uint32_t halfPeriod = rate / toneHz / 2;
+    for(int i=0;i<samples;i++){
+        if(left == 0){
+            if(!ring.pop(state)){
+                ++underruns;
+                started = false;
+                memset(out + i, 0, (samples - i) * sizeof(int16_t));
+                return;
+            }
+            on = state != 0;
+            left = samplesPerFrame;
+        }
+        out[i] = on ? ((phase / halfPeriod) & 1 ? amplitude : -amplitude) : 0;
+        phase++;
+        left--;
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef BEEPER_H
+#define BEEPER_H
+
+// SDL audio output for the sound timer
+//
+// The emulation thread calls push() once per emulated frame with whether the
+// sound timer is running, the SDL audio callback turns every entry into one
+// frame worth of square wave. The two only share a SpscRing, push() never
+// blocks and drops the entry if the ring is full.
+#include <SDL2/SDL.h>
+#include <atomic>
+#include <cstdint>
+#include "spscring.h"
+
+class Beeper{
+public:
+    // queueFrames is how many frames of beeper state can wait for the
+    // callback and open() takes the SDL buffer size in samples, smaller
+    // means less latency and more underruns
+    explicit Beeper(size_t queueFrames = 8);
+    ~Beeper();
+
+    bool open(int samples = 512, int sampleRate = 48000);
+    void close();
+
+    // emulation thread, once per frame
+    void push(bool on);
+
+    // counters, safe to read from any thread
+    std::atomic<uint64_t> underruns; // callbacks that ran out of queued frames
+    std::atomic<uint64_t> overflows; // frames push() dropped on a full ring
+    std::atomic<uint64_t> skipped; // frames the callback dropped to catch up
+    std::atomic<uint32_t> latencySamples; // queued audio when the callback last ran
+    std::atomic<uint32_t> maxLatencySamples;
+
+    double latencyMs() const;
+    double maxLatencyMs() const;
+
+private:
+    static void callback(void* userdata, Uint8* stream, int len);
+    void fill(int16_t* out, int samples);
+
+    SpscRing<uint8_t> ring;
+    SDL_AudioDeviceID device;
+    int rate;
+    int deviceSamples;
+    int samplesPerFrame;
+
+    // only touched by the callback
+    bool started; // waits for half the queue before the first sample
+    bool on; // state of the frame being played
+    int left; // samples left of that frame
+    uint32_t phase;
+};
+
+#endif
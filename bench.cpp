@@ -0,0 +1,537 @@
+// Runs every dispatch engine on the same ROMs, checks that they all end in
+// the same machine state and reports how fast each one went
+//
+// usage: bench [-c cycles] [-r repeats] [-ipf instructionsPerTimerTick] [-variant v] [-games dir] [-json file] [-label name] [rom...]
+// with no ROM given a suite of synthetic programs is used: one exercising
+// every instruction and one each stressing the ALU, drawing, bulk register
+// moves and call/return chains
+// -games adds the games from the screenshots found in dir (pong, tetris,
+// flight_runner, test_opcode as .rom or .ch8)
+// -json writes every run to file so results can be compared across commits,
+// -label tags them (a commit hash say)
+// exits with 1 if any engine disagrees with the Table engine or the rewind
+// rows (see checkRewind()) get a frame back wrong
+// the lockstep row runs 16 copies of the ROM with different random seeds for
+// cycles/16 each, lane 0 is checked against a Table run of the same length
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <memory>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "chip8.h"
+#include "romfile.h"
+#include "jit.h"
+#include "aot.h"
+#include "lockstep.h"
+#include "rewind.h"
+#include "savestate.h"
+
+struct EngineInfo{
+    chip8::Engine engine;
+    const char* name;
+    bool jit; // run through the Jit instead of chip8::run()
+    bool aot; // run the program chip8aot compiled for this ROM, if one is linked in
+};
+
+static const EngineInfo engines[] = {
+    {chip8::Engine::Table, "table", false, false},
+    {chip8::Engine::Switch, "switch", false, false},
+    {chip8::Engine::Threaded, "threaded", false, false},
+    {chip8::Engine::Specialized, "specialized", false, false},
+    {chip8::Engine::Table, "jit", true, false},
+    {chip8::Engine::Table, "aot", false, true},
+};
+
+struct Rom{
+    std::string name;
+    std::vector<uint8_t> data;
+};
+
+// Small generator so the synthetic ROM is the same on every host
+struct Lcg{
+    uint32_t s;
+    uint32_t next(){ s = s * 1664525u + 1013904223u; return s >> 8; }
+    uint32_t below(uint32_t n){ return next() % n; }
+};
+
+// A loop of random but well behaved instructions: memory ops only touch
+// 0xE00-0xEFF, sprites stay on screen, calls return, skips skip a 7xkk and
+// one store writes over an instruction further down so the decode cache
+// invalidation gets exercised on every pass
+static Rom syntheticRom(uint32_t seed){
+    Lcg r{seed};
+    std::vector<uint16_t> w;
+    const uint16_t sub = 0x800;
+
+    while(w.size() < 600){
+        uint16_t x = r.below(16), y = r.below(16), kk = r.below(256);
+        switch(r.below(14)){
+            case 0: w.push_back(0x6000 | x << 8 | kk); break;
+            case 1: w.push_back(0x7000 | x << 8 | kk); break;
+            case 2: {
+                static const uint16_t n8[] = {0,1,2,3,4,5,6,7,0xE};
+                w.push_back(0x8000 | x << 8 | y << 4 | n8[r.below(9)]);
+                break;
+            }
+            case 3: w.push_back(0xC000 | x << 8 | kk); break;
+            case 4: {
+                static const uint16_t f[] = {0x07,0x15,0x18,0x1E,0x29};
+                w.push_back(0xF000 | x << 8 | f[r.below(5)]);
+                break;
+            }
+            case 5: {
+                static const uint16_t f[] = {0x33,0x55,0x65};
+                w.push_back(0xAE00 | r.below(0xF0));
+                w.push_back(0xF000 | x << 8 | f[r.below(3)]);
+                break;
+            }
+            case 6:
+                w.push_back(0x6A00 | r.below(56));
+                w.push_back(0x6B00 | r.below(27));
+                w.push_back(0xF029 | x << 8);
+                w.push_back(0xDAB0 | (1 + r.below(5)));
+                break;
+            case 7: {
+                static const uint16_t s[] = {0x3000,0x4000,0x5000,0x9000};
+                uint16_t op = s[r.below(4)];
+                w.push_back(op | x << 8 | ((op == 0x5000 || op == 0x9000) ? y << 4 : kk));
+                w.push_back(0x7000 | y << 8 | kk);
+                break;
+            }
+            case 8:
+                w.push_back(0x6000 | x << 8 | r.below(16));
+                w.push_back((r.below(2) ? 0xE09E : 0xE0A1) | x << 8);
+                w.push_back(0x7000 | y << 8 | kk);
+                break;
+            case 9: w.push_back(0x2000 | sub); break;
+            case 10: {
+                // V0 = 0x6r, V1 = kk, then F155 turns the 6r00 below into 6rkk
+                uint16_t target = startLocation + (w.size() + 5) * 2;
+                w.push_back(0x6060 | r.below(16));
+                w.push_back(0x6100 | kk);
+                w.push_back(0xA000 | target);
+                w.push_back(0xF155);
+                w.push_back(0x7200 | kk);
+                w.push_back(0x6000 | r.below(16) << 8);
+                break;
+            }
+            case 11: {
+                // Bnnn landing on the next instruction, V0 and the Vx a
+                // SUPER-CHIP Bxnn adds hold the same offset so it does either way
+                uint16_t next = startLocation + (w.size() + 3) * 2;
+                uint16_t target = next - (kk & 0x3F);
+                w.push_back(0x6000 | (kk & 0x3F));
+                w.push_back(0x6000 | (target & 0x0F00) | (kk & 0x3F));
+                w.push_back(0xB000 | target);
+                break;
+            }
+            case 12: if(r.below(8) == 0) w.push_back(0x00E0); break;
+            default: w.push_back(0x8004 | x << 8 | y << 4); break;
+        }
+    }
+    w.push_back(0x1000 | startLocation);
+
+    Rom rom;
+    rom.name = "synthetic";
+    rom.data.resize(sub - startLocation + 8);
+    for(size_t i=0;i<w.size();i++){
+        rom.data[i*2] = w[i] >> 8;
+        rom.data[i*2+1] = w[i] & 0xFF;
+    }
+    // subroutine: a bit of arithmetic then return
+    const uint16_t body[] = {0x7301, 0x8434, 0x8546, 0x00EE};
+    for(int i=0;i<4;i++){
+        rom.data[sub - startLocation + i*2] = body[i] >> 8;
+        rom.data[sub - startLocation + i*2 + 1] = body[i] & 0xFF;
+    }
+    return rom;
+}
+
+// Puts words at 0x200 and calls the ROM name
+static Rom wordsRom(const char* name, const std::vector<uint16_t>& w){
+    Rom rom;
+    rom.name = name;
+    rom.data.resize(w.size() * 2);
+    for(size_t i=0;i<w.size();i++){
+        rom.data[i*2] = w[i] >> 8;
+        rom.data[i*2+1] = w[i] & 0xFF;
+    }
+    return rom;
+}
+
+static void setRegisters(Lcg& r, std::vector<uint16_t>& w, int count, int range){
+    for(int x=0;x<count;x++)
+        w.push_back(0x6000 | x << 8 | r.below(range));
+}
+
+// 8xy0 to 8xyE with random registers, nothing else in the loop
+static Rom aluRom(uint32_t seed){
+    Lcg r{seed};
+    std::vector<uint16_t> w;
+    setRegisters(r, w, 16, 256);
+    const uint16_t loop = startLocation + w.size() * 2;
+    static const uint16_t n8[] = {0,1,2,3,4,5,6,7,0xE};
+    for(int i=0;i<500;i++)
+        w.push_back(0x8000 | r.below(16) << 8 | r.below(16) << 4 | n8[r.below(9)]);
+    w.push_back(0x1000 | loop);
+    return wordsRom("alu", w);
+}
+
+// Dxyn all over the screen, now and then picking another digit or moving
+// a coordinate
+static Rom drawRom(uint32_t seed){
+    Lcg r{seed};
+    std::vector<uint16_t> w;
+    setRegisters(r, w, 15, 64);
+    const uint16_t loop = startLocation + w.size() * 2;
+    for(int i=0;i<500;i++){
+        uint16_t x = r.below(15), y = r.below(15);
+        if(i % 16 == 0)
+            w.push_back(0xF029 | x << 8);
+        else if(i % 8 == 0)
+            w.push_back(0x7000 | y << 8 | r.below(256));
+        else
+            w.push_back(0xD000 | x << 8 | y << 4 | (1 + r.below(5)));
+    }
+    w.push_back(0x1000 | loop);
+    return wordsRom("draw", w);
+}
+
+// Fx55 and Fx65 of most of the registers to and from 0xE00-0xEFF
+static Rom bulkRom(uint32_t seed){
+    Lcg r{seed};
+    std::vector<uint16_t> w;
+    setRegisters(r, w, 16, 256);
+    const uint16_t loop = startLocation + w.size() * 2;
+    for(int i=0;i<250;i++){
+        w.push_back(0xAE00 | r.below(0xF0));
+        w.push_back((r.below(2) ? 0xF055 : 0xF065) | (8 + r.below(8)) << 8);
+    }
+    w.push_back(0x1000 | loop);
+    return wordsRom("bulk", w);
+}
+
+// Calls 12 deep and back, 16 times per pass
+static Rom callsRom(){
+    const int depth = 12, calls = 16;
+    std::vector<uint16_t> w;
+    const uint16_t first = startLocation + (calls + 1) * 2;
+    for(int i=0;i<calls;i++)
+        w.push_back(0x2000 | first);
+    w.push_back(0x1000 | startLocation);
+    for(int d=0;d<depth;d++){
+        if(d + 1 < depth)
+            w.push_back(0x2000 | (first + (d + 1) * 4));
+        else
+            w.push_back(0x7001);
+        w.push_back(0x00EE);
+    }
+    return wordsRom("calls", w);
+}
+
+static bool readRom(const char* fileName, Rom& rom, std::string& error){
+    RomFile f;
+    if(!f.open(fileName, error))
+        return false;
+    rom.name = fileName;
+    rom.data.assign(f.data(), f.data() + f.size());
+    return true;
+}
+
+// Games from the screenshots, looked for in the -games directory
+static const char* const gameNames[] = {"pong", "tetris", "flight_runner", "test_opcode"};
+
+// One engine on one ROM, ns per instruction of every repeat
+struct Result{
+    std::string rom;
+    std::string engine;
+    uint64_t instructions;
+    std::vector<double> ns;
+    uint64_t hash;
+    bool same;
+
+    double best() const{
+        double b = ns[0];
+        for(double v : ns)
+            b = v < b ? v : b;
+        return b;
+    }
+    double mean() const{
+        double sum = 0;
+        for(double v : ns)
+            sum += v;
+        return sum / ns.size();
+    }
+    double stddev() const{
+        double m = mean(), sum = 0;
+        for(double v : ns)
+            sum += (v - m) * (v - m);
+        return ns.size() > 1 ? std::sqrt(sum / (ns.size() - 1)) : 0;
+    }
+};
+
+// ns/instr of the best run, its MIPS and the spread between runs
+static void printResult(const Result& r, const char* extra){
+    const double best = r.best(), mean = r.mean();
+    std::cout << "  " << std::left << std::setw(12) << r.engine << std::right
+              << std::fixed << std::setprecision(2) << std::setw(8) << best << " ns/instr "
+              << std::setw(10) << 1e3 / best << " MIPS "
+              << std::setprecision(1) << std::setw(6) << (mean > 0 ? 100 * r.stddev() / mean : 0) << "%  "
+              << std::hex << std::setw(16) << std::setfill('0') << r.hash << std::dec << std::setfill(' ')
+              << extra << (r.same ? "" : "  MISMATCH") << std::endl;
+}
+
+// Pushes a frame of rom at a time into a rewind ring about eight keyframes
+// big and after every push rewinds a copy of the ring through every frame it
+// still holds, comparing each with the state saved when it was pushed.
+// Returns the frames compared, 0 on a mismatch. The top 256 bytes of memory
+// are cleared or filled with random bytes at random before every push: a
+// frame bigger than the ones before it is what leaves old frames at the end
+// of the ring when it wraps. The 100 keyframes pushed go round it a dozen times
+static uint64_t checkRewind(const Rom& rom, chip8::Variant variant, uint32_t keyInterval){
+    const int frameCycles = 50;
+    std::unique_ptr<chip8> c(new chip8), back(new chip8);
+    c->loadProgram(rom.data.data(), rom.data.size());
+    c->timerPeriod = frameCycles;
+    c->variant = variant;
+
+    Rewind probe;
+    probe.push(*c);
+    Rewind ring(probe.bytesUsed() * 8, keyInterval);
+    Lcg r{keyInterval};
+    std::deque<std::vector<uint8_t>> history;
+    uint64_t compared = 0;
+    for(uint32_t frame=0;frame<100 * keyInterval;frame++){
+        c->run(frameCycles, chip8::Engine::Table);
+        memset(c->memory + 0xF00, 0, 256);
+        for(uint32_t n=r.below(2) ? 256 : 0;n>0;n--)
+            c->memory[0xF00 + r.below(256)] = (uint8_t)r.next();
+        c->invalidate(0xF00, 256);
+        ring.push(*c);
+        history.push_back(saveState(*c));
+        while(history.size() > ring.frames())
+            history.pop_front();
+
+        Rewind copy(ring);
+        for(size_t i=history.size();i>0;i--){
+            // 0 is the newest, after that each rewind(1) drops the frame
+            // just compared and lands on the one before it
+            if(!copy.rewind(*back, i == history.size() ? 0 : 1) || saveState(*back) != history[i - 1])
+                return 0;
+            compared++;
+        }
+    }
+    return compared;
+}
+
+static std::string jsonString(const std::string& s){
+    std::string out = "\"";
+    for(char ch : s){
+        if(ch == '"' || ch == '\\')
+            out += '\\';
+        if((unsigned char)ch >= 0x20)
+            out += ch;
+    }
+    return out + "\"";
+}
+
+static bool writeJson(const char* fileName, const std::string& label, uint64_t cycles, uint32_t ipf,
+                      chip8::Variant variant, const std::vector<Result>& results){
+    std::ofstream f(fileName);
+    if(!f)
+        return false;
+    f << "{\"label\":" << jsonString(label) << ",\"cycles\":" << cycles << ",\"ipf\":" << ipf
+      << ",\"variant\":\"" << chip8_variantnames[(int)variant] << "\",\"results\":[" << std::endl;
+    for(size_t i=0;i<results.size();i++){
+        const Result& r = results[i];
+        char hash[17];
+        snprintf(hash, sizeof(hash), "%016llx", (unsigned long long)r.hash);
+        f << "{\"rom\":" << jsonString(r.rom) << ",\"engine\":" << jsonString(r.engine)
+          << ",\"instructions\":" << r.instructions << ",\"ns\":[";
+        for(size_t k=0;k<r.ns.size();k++)
+            f << (k ? "," : "") << r.ns[k];
+        f << "],\"best_ns\":" << r.best() << ",\"mean_ns\":" << r.mean() << ",\"stddev_ns\":" << r.stddev()
+          << ",\"ips\":" << 1e9 / r.best() << ",\"hash\":\"" << hash << "\",\"match\":" << (r.same ? "true" : "false")
+          << "}" << (i + 1 < results.size() ? "," : "") << std::endl;
+    }
+    f << "]}" << std::endl;
+    return (bool)f;
+}
+
+int main(int argc, char* argv[]){
+    uint64_t cycles = 20000000;
+    int repeats = 3;
+    uint32_t ipf = 1;
+    chip8::Variant variant = chip8::Variant::Modern;
+    const char* gamesDir = nullptr;
+    const char* jsonFile = nullptr;
+    std::string label;
+    std::vector<Rom> roms;
+
+    for(int i=1;i<argc;i++){
+        if(!strcmp(argv[i],"-c") && i+1 < argc)
+            cycles = strtoull(argv[++i],NULL,0);
+        else if(!strcmp(argv[i],"-r") && i+1 < argc)
+            repeats = atoi(argv[++i]);
+        else if(!strcmp(argv[i],"-ipf") && i+1 < argc)
+            ipf = strtoul(argv[++i],NULL,0);
+        else if(!strcmp(argv[i],"-variant") && i+1 < argc && chip8_parseVariant(argv[i+1],variant))
+            i++;
+        else if(!strcmp(argv[i],"-games") && i+1 < argc)
+            gamesDir = argv[++i];
+        else if(!strcmp(argv[i],"-json") && i+1 < argc)
+            jsonFile = argv[++i];
+        else if(!strcmp(argv[i],"-label") && i+1 < argc)
+            label = argv[++i];
+        else{
+            Rom rom;
+            std::string error;
+            if(!readRom(argv[i],rom,error)){
+                std::cerr << error << std::endl;
+                return 1;
+            }
+            roms.push_back(rom);
+        }
+    }
+    if(repeats < 1)
+        repeats = 1;
+    if(roms.empty()){
+        roms.push_back(syntheticRom(1));
+        roms.push_back(aluRom(2));
+        roms.push_back(drawRom(3));
+        roms.push_back(bulkRom(4));
+        roms.push_back(callsRom());
+    }
+    if(gamesDir){
+        for(const char* game : gameNames){
+            Rom rom;
+            std::string base = std::string(gamesDir) + "/" + game;
+            std::string error;
+            if(!readRom((base + ".rom").c_str(), rom, error) && !readRom((base + ".ch8").c_str(), rom, error)){
+                std::cerr << "no " << game << ".rom or " << game << ".ch8 in " << gamesDir << ", skipped" << std::endl;
+                continue;
+            }
+            rom.name = game;
+            roms.push_back(rom);
+        }
+    }
+
+    bool ok = true;
+    std::vector<Result> results;
+    for(const Rom& rom : roms){
+        std::cout << rom.name << " (" << cycles << " cycles, best of " << repeats << ", spread is the std deviation)" << std::endl;
+        uint64_t reference = 0;
+        // decoded again before every run, outside the timing
+        std::unique_ptr<chip8::Code> code(new chip8::Code);
+
+        for(const EngineInfo& e : engines){
+            if(e.aot){
+                chip8* probe = new chip8;
+                probe->loadProgram(rom.data.data(), rom.data.size());
+                probe->variant = variant;
+                bool found = aotFind(*probe) != nullptr;
+                delete probe;
+                if(!found)
+                    continue;
+            }
+            Result result{rom.name, e.name, cycles, {}, 0, true};
+            for(int rep=0;rep<repeats;rep++){
+                chip8* c = new chip8;
+                c->loadProgram(rom.data.data(), rom.data.size());
+                c->decodeAll(*code);
+                c->timerPeriod = ipf ? ipf : 1;
+                c->variant = variant;
+                Jit* jit = e.jit ? new Jit : nullptr;
+                if(jit)
+                    jit->attach(*c);
+
+                auto start = std::chrono::steady_clock::now();
+                if(jit)
+                    jit->run(cycles);
+                else if(e.aot)
+                    aotRun(*aotFind(*c), *c, cycles);
+                else
+                    c->run(cycles, e.engine);
+                auto end = std::chrono::steady_clock::now();
+                delete jit;
+
+                result.ns.push_back(std::chrono::duration<double, std::nano>(end - start).count() / cycles);
+                result.hash = c->hashState();
+                delete c;
+            }
+
+            if(&e == &engines[0])
+                reference = result.hash;
+            result.same = result.hash == reference;
+            ok = ok && result.same;
+            printResult(result, "");
+            results.push_back(result);
+        }
+
+        const int lanes = 16;
+        const uint64_t laneCycles = cycles / lanes;
+        chip8* check = new chip8;
+        check->loadProgram(rom.data.data(), rom.data.size());
+        check->timerPeriod = ipf ? ipf : 1;
+        check->variant = variant;
+        check->run(laneCycles, chip8::Engine::Table);
+        reference = check->hashState();
+        delete check;
+
+        const double total = (double)laneCycles * lanes;
+        Result result{rom.name, "lockstep", (uint64_t)total, {}, 0, true};
+        double vectorShare = 0;
+        for(int rep=0;rep<repeats;rep++){
+            chip8* c[lanes];
+            for(int l=0;l<lanes;l++){
+                c[l] = new chip8;
+                c[l]->loadProgram(rom.data.data(), rom.data.size());
+                if(l == 0)
+                    c[l]->decodeAll(*code);
+                else
+                    c[l]->setCode(code.get());
+                c[l]->timerPeriod = ipf ? ipf : 1;
+                c[l]->seed(l);
+                c[l]->variant = variant;
+            }
+            Lockstep<lanes> group(c);
+
+            auto start = std::chrono::steady_clock::now();
+            group.run(laneCycles);
+            auto end = std::chrono::steady_clock::now();
+
+            result.ns.push_back(std::chrono::duration<double, std::nano>(end - start).count() / total);
+            result.hash = c[0]->hashState();
+            vectorShare = (double)group.vectorSteps / (group.vectorSteps + group.scalarSteps);
+            for(int l=0;l<lanes;l++)
+                delete c[l];
+        }
+
+        result.same = result.hash == reference;
+        ok = ok && result.same;
+        std::string share = "  " + std::to_string((int)(vectorShare * 100 + 0.5)) + "% vector";
+        printResult(result, share.c_str());
+        results.push_back(result);
+
+        for(uint32_t keyInterval : {1u, 8u}){
+            uint64_t compared = checkRewind(rom, variant, keyInterval);
+            std::cout << "  rewind      every " << keyInterval << (keyInterval == 1 ? " frame is" : " frames are")
+                      << " a keyframe, " << compared << " rewound frames" << (compared ? "" : "  MISMATCH") << std::endl;
+            ok = ok && compared;
+        }
+    }
+
+    if(jsonFile && !writeJson(jsonFile, label, cycles, ipf, variant, results)){
+        std::cerr << "could not write " << jsonFile << std::endl;
+        return 1;
+    }
+    return ok ? 0 : 1;
+}
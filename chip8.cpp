@@ -1,13 +1,9 @@
-#include <SDL2/SDL.h>
-#include <iostream>
-#include <chrono>
-#include <cstdint>
-#include <cstring>
-
-#define startLocation 0x200
-#define fontSetStart 0x50
-#define screen_width 64
-#define screen_height 32
+#include "chip8.h"
+#include "romfile.h"
+#include <cstdio>
+#ifdef CHIP8_PROFILE
+#include "profile.h"
+#endif
 
 uint8_t chip8_fontset[80] = {
   0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
@@ -28,574 +24,284 @@ uint8_t chip8_fontset[80] = {
   0xF0, 0x80, 0xF0, 0x80, 0x80  // F
 };
 
+// indexed by OpId, same order as the enum, for the variant's Quirks Q
+#define CHIP8_HANDLERS(Q) { \
+    &chip8::op_NULL, &chip8::op_00E0, &chip8::op_00EE, &chip8::op_1, &chip8::op_2, \
+    &chip8::op_3, &chip8::op_4, &chip8::op_5, &chip8::op_6, &chip8::op_7, \
+    &chip8::op_8xy0, &chip8::op_8xy1, &chip8::op_8xy2, &chip8::op_8xy3, &chip8::op_8xy4, \
+    &chip8::op_8xy5, &chip8::op_8xy6<Q>, &chip8::op_8xy7, &chip8::op_8xyE<Q>, \
+    &chip8::op_9, &chip8::op_A, &chip8::op_B<Q>, &chip8::op_C, &chip8::op_D<Q>, \
+    &chip8::op_Ex9E, &chip8::op_ExA1, \
+    &chip8::op_Fx07, &chip8::op_Fx0A, &chip8::op_Fx15, &chip8::op_Fx18, &chip8::op_Fx1E, \
+    &chip8::op_Fx29, &chip8::op_Fx33, &chip8::op_Fx55<Q>, &chip8::op_Fx65<Q> \
+}
 
-void Update(void const* buffer, int pitch, SDL_Renderer* renderer,SDL_Texture* texture);
-void ProcessInput(uint8_t* keys);
-
-class chip8{
-public:
-
-    //program memory location begins at 512 (0x200)
-    //The uppermost 256 bytes (0xF00-0xFFF)(3840-4095) are reserved for display refresh
-    // 0x050-0x0A0 - Used for the built in 4x5 pixel font set (0-F)
-    // 1 byte x 4K Memory
-    uint8_t memory[4096];
-
-    // 1 byte x 16 Registers
-    uint8_t V[16];
-
-    // 1 byte index register
-    uint16_t I;
-
-    // 2 byte program Counter
-    uint16_t pc;
-
-    // 1 byte x 16 gor keypad state
-    uint8_t keypad[16];
-
-    // 1 byte x 2K Video Memory (64 x 32)
-    uint32_t gfx[screen_width * screen_height];
-
-    // stack and stack pointer
-    uint16_t stack[16];
-    uint16_t sp;
-
-    uint16_t opcode;
-
-    uint8_t delayTimer;
-    uint8_t soundTimer;
-
-    // Function Pointer setup
-	typedef void (chip8::*Chip8Func)();
-    // if typedef is not used the syntax would be void (chip8::*table[0xE + 1])();
-    // We Declare an array "table" which has elements made up of member class addresses that return void
-    // array is initialized with op_NULL function address
-	Chip8Func table[0xF + 1]{&chip8::op_NULL};
-	Chip8Func table0[0xE + 1]{&chip8::op_NULL};
-	Chip8Func table8[0xE + 1]{&chip8::op_NULL};
-	Chip8Func tableE[0xE + 1]{&chip8::op_NULL};
-	Chip8Func tableF[0x65 + 1]{&chip8::op_NULL};
-
-    chip8(){
-        pc = startLocation;
-        srand(memory[13]);
-        for(int i=0;i<80;i++)
-            memory[i + fontSetStart] = chip8_fontset[i];
-
-        memset(keypad,0,sizeof(keypad));
-        memset(gfx,0,sizeof(gfx));
-
-        // MSB of the instruction
-        table[0x0] = &chip8::Table0; // Address of the Table0 function which then points to table0[]
-	    table[0x1] = &chip8::op_1;
-	    table[0x2] = &chip8::op_2;
-	    table[0x3] = &chip8::op_3;
-	    table[0x4] = &chip8::op_4;
-	    table[0x5] = &chip8::op_5;
-	    table[0x6] = &chip8::op_6;
-	    table[0x7] = &chip8::op_7;
-	    table[0x8] = &chip8::Table8; // Points to the Table8 function which then points to table8[]
-	    table[0x9] = &chip8::op_9;
-	    table[0xA] = &chip8::op_A;
-	    table[0xB] = &chip8::op_B;
-	    table[0xC] = &chip8::op_C;
-	    table[0xD] = &chip8::op_D;
-	    table[0xE] = &chip8::TableE; // Points to the TableE function which then points to tableE[]
-	    table[0xF] = &chip8::TableF; // Points to the TableF function which then points to tableF[]
-
-        // these Instructions are returned by the Table0() func
-        table0[0x0] = &chip8::op_00E0;
-	    table0[0xE] = &chip8::op_00EE;
-
-        // these Instructions are returned by the Table8() func
-	    table8[0x0] = &chip8::op_8xy0;
-	    table8[0x1] = &chip8::op_8xy1;
-	    table8[0x2] = &chip8::op_8xy2;
-	    table8[0x3] = &chip8::op_8xy3;
-	    table8[0x4] = &chip8::op_8xy4;
-	    table8[0x5] = &chip8::op_8xy5;
-	    table8[0x6] = &chip8::op_8xy6;
-	    table8[0x7] = &chip8::op_8xy7;
-	    table8[0xE] = &chip8::op_8xyE;
-
-        // these Instructions are returned by the TableE() func
-	    tableE[0x1] = &chip8::op_ExA1;
-	    tableE[0xE] = &chip8::op_Ex9E;
-
-        // these Instructions are returned by the TableF() func
-	    tableF[0x07] = &chip8::op_Fx07;
-	    tableF[0x0A] = &chip8::op_Fx0A;
-	    tableF[0x15] = &chip8::op_Fx15;
-	    tableF[0x18] = &chip8::op_Fx18;
-	    tableF[0x1E] = &chip8::op_Fx1E;
-	    tableF[0x29] = &chip8::op_Fx29;
-	    tableF[0x33] = &chip8::op_Fx33;
-	    tableF[0x55] = &chip8::op_Fx55;
-	    tableF[0x65] = &chip8::op_Fx65;
-    }
-
-    void Table0(){
-        ((*this).*(table0[opcode & 0x000F]))();
-    }
-
-    void Table8(){
-        ((*this).*(table8[opcode & 0x000F]))();
-    }
-
-    void TableE(){
-        ((*this).*(tableE[opcode & 0x000F]))();
-    }
-
-    void TableF(){
-        ((*this).*(tableF[opcode & 0x00FF]))();
-    }
-
-    void op_NULL(){}
-
-
-    // Instructions Below
-    // Reference ==> http://devernay.free.fr/hacks/chip8/C8TECH10.HTM
-    void op_00E0(){
-        memset(gfx,0,sizeof(gfx));
-    }
-
-    void op_00EE(){
-        --sp;
-	    pc = stack[sp];
-    }
-
-    void op_1(){
-        pc = (opcode & 0x0FFF);
-    }
-
-    void op_2(){
-        stack[sp] = pc;
-        sp++;
-        pc = opcode & 0x0FFF;
-    }
-
-    void op_3(){
-        if(V[(opcode & 0x0F00)>>8] == (opcode & 0x00FF))
-            pc += 2;
-    }
-
-    void op_4(){
-        if(V[(opcode & 0x0F00)>>8] != (opcode & 0x00FF))
-            pc += 2;
-    }
-
-    void op_5(){
-        if(V[(opcode & 0x0F00)>>8] == V[(opcode & 0x00F0)>>4])
-            pc += 2;
-    }
-
-    void op_6(){
-        V[(opcode & 0x0F00)>>8] = (opcode & 0x00FF);
-    }
-
-    void op_7(){
-        V[(opcode & 0x0F00)>>8] += (opcode & 0x00FF);
-    }
-
-    void op_8xy0(){
-        V[(opcode & 0x0F00)>>8] = V[(opcode & 0x00F0)>>4];
-    }
-
-    void op_8xy1(){
-        V[(opcode & 0x0F00)>>8] |= V[(opcode & 0x00F0)>>4];
-    }
-
-    void op_8xy2(){
-        V[(opcode & 0x0F00)>>8] &= V[(opcode & 0x00F0)>>4];
-    }
-
-    void op_8xy3(){
-        V[(opcode & 0x0F00)>>8] ^= V[(opcode & 0x00F0)>>4];
-    }
-
-    void op_8xy4(){
-        if(V[(opcode & 0x00F0)>>4] > (0xFF - V[(opcode & 0x0F00)>>8]))
-            V[0xF] = 1;
-        else
-            V[0xF] = 0;
-        V[(opcode & 0x0F00)>>8] += V[(opcode & 0x00F0)>>4];
-    }
-
-    void op_8xy5(){
-        if(V[(opcode & 0x0F00)>>8] > V[(opcode & 0x00F0)>>4])
-            V[0xF] = 1;
-        else
-            V[0xF] = 0;
-        V[(opcode & 0x0F00)>>8] -= V[(opcode & 0x00F0)>>4];
-    }
-
-    void op_8xy6(){
-        V[0xF] = V[(opcode & 0x0F00)>>8] & 0x1;
-        V[(opcode & 0x0F00)>>8] >>= 1;
-    }
-
-    void op_8xy7(){
-        if(V[(opcode & 0x00F0)>>4] > V[(opcode & 0x0F00)>>8])
-            V[0xF] = 1;
-        else
-            V[0xF] = 0;
-        V[(opcode & 0x0F00)>>8] = V[(opcode & 0x00F0)>>4] - V[(opcode & 0x0F00)>>8];
-    }
+// indexed by Variant
+const chip8::Chip8Func chip8::handlers[chip8::VARIANT_COUNT][chip8::OP_COUNT] = {
+    CHIP8_HANDLERS(chip8::ModernQuirks),
+    CHIP8_HANDLERS(chip8::CosmacQuirks),
+    CHIP8_HANDLERS(chip8::SuperChipQuirks),
+    CHIP8_HANDLERS(chip8::XoChipQuirks)
+};
 
-    void op_8xyE(){
-        if((V[(opcode & 0x0F00)>>8] & (0b1<<8))>>8)
-            V[0xF] = 1;
-        else
-            V[0xF] = 0;
-        V[(opcode & 0x0F00)>>8] <<= 1;
-    }
+#undef CHIP8_HANDLERS
 
-    void op_9(){
-        if(V[(opcode & 0x0F00)>>8] != V[(opcode & 0x00F0)>>4])
-            pc += 2;
-    }
+const char* const chip8_variantnames[chip8::VARIANT_COUNT] = {"modern", "cosmac", "schip", "xochip"};
 
-    void op_A(){
-        I = (opcode & 0x0FFF);
+bool chip8_parseVariant(const char* name, chip8::Variant& variant){
+    for(int v=0;v<chip8::VARIANT_COUNT;v++){
+        if(!strcmp(name, chip8_variantnames[v])){
+            variant = (chip8::Variant)v;
+            return true;
+        }
     }
+    return false;
+}
 
-    void op_B(){
-        pc = (opcode & 0x0FFF) + V[0];
-    }
+const char* const chip8_opnames[chip8::OP_COUNT] = {
+    "op_NULL", "op_00E0", "op_00EE", "op_1", "op_2", "op_3", "op_4", "op_5", "op_6", "op_7",
+    "op_8xy0", "op_8xy1", "op_8xy2", "op_8xy3", "op_8xy4", "op_8xy5", "op_8xy6", "op_8xy7", "op_8xyE",
+    "op_9", "op_A", "op_B", "op_C", "op_D", "op_Ex9E", "op_ExA1",
+    "op_Fx07", "op_Fx0A", "op_Fx15", "op_Fx18", "op_Fx1E", "op_Fx29", "op_Fx33", "op_Fx55", "op_Fx65"
+};
 
-    void op_C(){
-        V[(opcode & 0x0F00)>>8] = (rand()%(0xFF)) & (opcode & 0x00FF);
-    }
+const char* const chip8_fusenames[chip8::FUSE_COUNT] = {
+    "none", "6xkk+Dxyn", "7xkk+skip+1nnn", "Fx1E+Fx65", "Fx1E+Fx55", "Fx65+Fx1E", "Fx55+Fx1E",
+    "idle jump", "idle timer poll", "idle key wait"
+};
 
-    // Taken this func from online reference
-    void op_D(){
-        uint8_t height = opcode & 0x000Fu;
+bool chip8::loadProgram(const char* fileName){
+    RomFile rom;
+    std::string error;
+    if(!rom.open(fileName, error))
+        return false;
+    return loadProgram(rom.data(), rom.size());
+}
 
-        // Wrap if going beyond screen boundaries
-        uint8_t xPos = V[(opcode & 0x0F00)>>8] % screen_width;
-        uint8_t yPos = V[(opcode & 0x00F0)>>4] % screen_height;
+bool chip8::loadProgram(const uint8_t* data, size_t size){
+    if(size > maxRomSize)
+        return false;
+    memcpy(memory + startLocation, data, size);
+    invalidate(startLocation,size);
+    // the freshly loaded image is the baseline, not a write
+    dirtyPages = 0;
+    return true;
+}
 
-        V[0xF] = 0;
+uint64_t chip8::hashState() const{
+    uint64_t h = 1469598103934665603ull;
+    auto mix = [&h](const void* p, size_t n){
+        const uint8_t* b = (const uint8_t*)p;
+        for(size_t i=0;i<n;i++){
+            h ^= b[i];
+            h *= 1099511628211ull;
+        }
+    };
+    mix(memory,sizeof(memory));
+    mix(V,sizeof(V));
+    mix(&I,sizeof(I));
+    mix(&pc,sizeof(pc));
+    mix(stack,sizeof(stack));
+    mix(&sp,sizeof(sp));
+    mix(&delayTimer,sizeof(delayTimer));
+    mix(&soundTimer,sizeof(soundTimer));
+    mix(&timerPhase,sizeof(timerPhase));
+    mix(&rngState,sizeof(rngState));
+    mix(gfx,sizeof(gfx));
+    return h;
+}
 
-        for (unsigned int row = 0; row < height; ++row){
-            uint8_t spriteByte = memory[I + row];
+uint64_t chip8::rollingHash(){
+    for(int page=0;page<64;page++){
+        if(!((hashPages >> page) & 1))
+            continue;
+        uint64_t h = mix64(0x10000 + page);
+        for(int i=0;i<64;i+=8){
+            uint64_t word;
+            memcpy(&word, memory + page*64 + i, sizeof(word));
+            h = mix64(h ^ word);
+        }
+        memHash ^= pageHash[page] ^ h;
+        pageHash[page] = h;
+    }
+    for(int y=0;y<screen_height;y++){
+        if(!((hashRows >> y) & 1))
+            continue;
+        uint64_t h = mix64(gfx[y] ^ mix64(0x20000 + y));
+        gfxHash ^= rowHash[y] ^ h;
+        rowHash[y] = h;
+    }
+    hashPages = 0;
+    hashRows = 0;
+
+    // the registers are few enough to fold in every time, the handlers
+    // writing them (and the JIT and lock step engines that bypass those)
+    // stay as they were
+    uint64_t words[8];
+    memcpy(words, V, sizeof(V));
+    memcpy(words + 2, stack, sizeof(stack));
+    words[6] = (uint64_t)I | (uint64_t)pc << 16 | (uint64_t)sp << 32 |
+               (uint64_t)delayTimer << 48 | (uint64_t)soundTimer << 56;
+    words[7] = (uint64_t)timerPhase | (uint64_t)rngState << 32;
+    uint64_t h = memHash ^ gfxHash;
+    for(uint64_t w : words)
+        h = mix64(h + w);
+    return h;
+}
 
-            for (unsigned int col = 0; col < 8; ++col){
-                uint8_t spritePixel = spriteByte & (0x80 >> col);
-                uint32_t* screenPixel = &gfx[(yPos + row) * screen_width + (xPos + col)];
+void chip8::decodeAll(Code& into){
+    memcpy(into.memory, memory, sizeof(memory));
+    for(uint16_t addr=0;addr<sizeof(memory);addr++)
+        decode(memory, addr, into.slots[addr]);
+    setCode(&into);
+}
 
-                // Sprite pixel is on
-                if (spritePixel){
-                    // Screen pixel also on - collision
-                    if (*screenPixel == 0xFFFFFFFF){
-                        V[0xF] = 1;
+void chip8::setCode(const Code* shared){
+    code = shared;
+    if(!code){
+        memset(localSlots,0xFF,sizeof(localSlots));
+        return;
+    }
+    for(int page=0;page<64;page++){
+        // the last slots of a page read the start of the next one
+        const int next = (page + 1) % 64 * 64;
+        uint64_t bits = 0;
+        if(memcmp(memory + page*64, code->memory + page*64, 64) || memcmp(memory + next, code->memory + next, 5)){
+            for(int i=0;i<64;i++){
+                for(int k=0;k<6;k++){
+                    const int a = (page*64 + i + k) & 0xFFF;
+                    if(memory[a] != code->memory[a]){
+                        bits |= 1ull << i;
+                        break;
                     }
-                    // Effectively XOR with the sprite pixel
-                    *screenPixel ^= 0xFFFFFFFF;
                 }
             }
         }
+        localSlots[page] = bits;
     }
+}
 
-    void op_Ex9E(){
-        if(keypad[V[(opcode & 0x0F00)>>8]])
-            pc += 2;
-    }
-
-    void op_ExA1(){
-        if(!keypad[V[(opcode & 0x0F00)>>8]])
-            pc += 2;
-    }
-
-    void op_Fx07(){
-        V[(opcode & 0x0F00)>>8] = delayTimer;
-    }
-
-    void op_Fx0A(){
-        uint8_t Vx = (opcode & 0x0F00) >> 8;
-        if(keypad[0]) V[Vx] = 0;
-        else if(keypad[1]) V[Vx] = 1;
-        else if(keypad[2]) V[Vx] = 2;
-        else if(keypad[3]) V[Vx] = 3;
-        else if(keypad[4]) V[Vx] = 4;
-        else if(keypad[5]) V[Vx] = 5;
-        else if(keypad[6]) V[Vx] = 6;
-        else if(keypad[7]) V[Vx] = 7;
-        else if(keypad[8]) V[Vx] = 8;
-        else if(keypad[9]) V[Vx] = 9;
-        else if(keypad[10]) V[Vx] = 10;
-        else if(keypad[11]) V[Vx] = 11;
-        else if(keypad[12]) V[Vx] = 12;
-        else if(keypad[13]) V[Vx] = 13;
-        else if(keypad[14]) V[Vx] = 14;
-        else if(keypad[15]) V[Vx] = 15;
-        else pc -= 2;
-    }
-
-    void op_Fx15(){
-        delayTimer = V[(opcode & 0x0F00) >> 8];
-    }
-
-    void op_Fx18(){
-        soundTimer = V[(opcode & 0x0F00) >> 8];
-    }
-
-    void op_Fx1E(){
-        I += V[(opcode & 0x0F00) >> 8];
-    }
-
-    void op_Fx29(){
-        I = fontSetStart + (V[(opcode & 0x0F00) >> 8] * 5);
-    }
-
-    void op_Fx33(){
-        uint8_t val = V[(opcode & 0x0F00) >> 8];
-        memory[I+2] = val%10;
-        val /= 10;
-        memory[I+1] = val%10;
-        val /= 10;
-        memory[I] = val%10;
-    }
-
-    void op_Fx55(){
-        for(uint8_t i=0;i<=((opcode & 0x0F00) >> 8);i++)
-            memory[I + i] = V[i];
-    }
-
-    void op_Fx65(){
-        for(uint8_t i=0;i <= ((opcode & 0x0F00) >> 8);i++)
-            V[i] = memory[I + i];
-    }
-
-    // Member Functions Defined Outside
-    void loadProgram(); // Loads File into Memory
-    void emulateCycle(); // Emulates one cycle
-    void printScreen(); // Prints to the screen
-};
-
-void chip8::loadProgram(){
-    uint8_t* buf;
-    char fileName[] = "tetris.rom";
-    FILE *ptr;
-    //opens the file for reading
-    ptr = fopen(fileName,"rb");
-
-    //takes the pointer to the end
-    fseek(ptr,0,SEEK_END);
-    // gets the total space required in bytes
-    int n = ftell(ptr);
-    //sets pointer back to start
-    fseek(ptr,0,SEEK_SET);
+void chip8::forkFrom(const chip8& parent){
+    if(&parent == this)
+        return;
+    // The overlay is a good part of a chip8, and this one already holds the
+    // same decodings wherever the two memories agree (slots only depend on
+    // the six bytes they read). So everything but the overlay is copied,
+    // the shared code and localSlots along with memory, and just the
+    // entries reading a page that differs are dropped
+    uint64_t differ = 0;
+    for(int page=0;page<64;page++){
+        if(memcmp(memory + page*64, parent.memory + page*64, 64))
+            differ |= 1ull << page;
+    }
+
+    // chip8 is trivially copyable (pool.h), the bytes on either side of the
+    // overlay are copied as they are
+    const char* from = (const char*)&parent;
+    char* to = (char*)this;
+    const size_t head = (const char*)localDecoded - to;
+    const size_t tail = (const char*)(local + LOCAL_COUNT) - to;
+    memcpy(to, from, head);
+    memcpy(to + tail, from + tail, sizeof(chip8) - tail);
+
+    for(int page=0;page<64;page++){
+        if(!((differ >> page) & 1))
+            continue;
+        // the last five slots of the page before read into this one
+        localDecoded[page] = 0;
+        localDecoded[(page + 63) % 64] &= ~0ull >> 5;
+    }
+
+    // whatever watches the parent (a JIT, a debugger, a tracer) stays with it
+    writeHook = nullptr;
+    writeHookCtx = nullptr;
+#ifdef CHIP8_PROFILE
+    profile = nullptr;
+#endif
+}
 
-    // creates buffer to store file
-    buf = (uint8_t *)malloc(n+1);
-    fread(buf,1,n,ptr);
-    fclose(ptr);
+void chip8::expandFrame(uint32_t* pixels) const{
+    expandRows(gfx, pixels, 0, screen_height);
+}
 
-    // takes buffer and stores it in the memory of the chip
-    for(int i=0;i<n;i++){
-        memory[i+startLocation] = *(buf + i);
+void chip8::expandRows(const uint64_t* rows, uint32_t* pixels, int first, int count){
+    for(int y=first;y<first+count;y++){
+        uint64_t row = rows[y];
+        for(int x=0;x<screen_width;x++)
+            *pixels++ = (row >> (63 - x)) & 1 ? 0xFFFFFFFF : 0;
     }
-
-    delete[] buf;
-    buf = NULL;
 }
 
 void chip8::emulateCycle(){
-    opcode = (memory[pc] << 8u) | memory[pc + 1];
+    // fetch and decode only happen the first time an address is executed
+    // or after something wrote over it
+    const Instr& in = fetch();
+    opcode = in.opcode;
 	pc += 2;
 
     /*
-    as the table array contains addresses of the chip8 member functions we dereference them
-    thus the syntax *(table[....])
-    the last two brackets are for parameters but our function doesnt take any parameter
-    we use *this as the table array is a public variable of the class chip8
+    the cache slot holds the handler id, handlers[variant][] maps it to the address of
+    the chip8 member function and we dereference it thus the syntax *(handlers[variant][in.id])
+    the decoded instruction is passed along so the handler does not pick apart the opcode again
+    we use *this as the handlers are member functions of the class chip8
     */
 
-	((*this).*(table[(opcode & 0xF000u) >> 12u]))();
-
-	if (delayTimer > 0)
-		--delayTimer;
-
-	// Decrement the sound timer if it's been set
-	if (soundTimer > 0)
-		--soundTimer;
-}
-
-int main(int argc, char* argv[]){
-    chip8 c;
-    c.loadProgram();
-
-    int cycleDelay = 3;
-
-    SDL_Init(SDL_INIT_VIDEO);
-    SDL_Window* window = SDL_CreateWindow("CHIP 8 Emu", 0, 0, screen_width * 10, screen_height * 10, SDL_WINDOW_SHOWN);
-    SDL_Renderer* renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
-    SDL_Texture* texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING, screen_width, screen_height);
-
-    auto lastCycleTime = std::chrono::high_resolution_clock::now();
-    int videoPitch = sizeof(c.gfx[0])*screen_width;
-	while(true){
-		ProcessInput(c.keypad);
-		auto currentTime = std::chrono::high_resolution_clock::now();
-		float dt = std::chrono::duration<float, std::chrono::milliseconds::period>(currentTime - lastCycleTime).count();
-
-		if (dt > cycleDelay)
-		{
-			lastCycleTime = currentTime;
+#ifdef CHIP8_PROFILE
+    if(profile){
+        // the handler may write over its own slot, keep the id
+        const uint8_t id = in.id;
+        profile->count[id]++;
+        profile->pcHits[(pc - 2) & 0xFFF]++;
+        uint64_t start = profileClock();
+        ((*this).*(handlers[(int)variant][id]))(in);
+        profile->ticks[id] += profileClock() - start;
+        retire();
+        return;
+    }
+#endif
 
-			c.emulateCycle();
+	((*this).*(handlers[(int)variant][in.id]))(in);
 
-			Update(c.gfx, videoPitch,renderer,texture);
-		}
-	}
-    return 0;
+	retire();
 }
 
-void ProcessInput(uint8_t* key){
-    SDL_Event event;
-	while(SDL_PollEvent(&event)){
-        if(event.type == SDL_KEYDOWN){
-
-            switch(event.key.keysym.sym){
-                case SDLK_x:
-                    key[0x0] = 1;
-                    break;
-
-                case SDLK_1:
-                    key[0x1] = 1;
-                    break;
-
-                case SDLK_2:
-                    key[0x2] = 1;
-                    break;
-
-                case SDLK_3:
-                    key[0x3] = 1;
-                    break;
-
-                case SDLK_q:
-                    key[0x4] = 1;
-                    break;
-
-                case SDLK_w:
-                    key[0x5] = 1;
-                    break;
-
-                case SDLK_e:
-                    key[0x6] = 1;
-                    break;
-
-                case SDLK_a:
-                    key[0x7] = 1;
-                    break;
-
-                case SDLK_s:
-                    key[0x8] = 1;
-                    break;
-
-                case SDLK_d:
-                    key[0x9] = 1;
-                    break;
-
-                case SDLK_z:
-                    key[0xA] = 1;
-                    break;
-
-                case SDLK_c:
-                    key[0xB] = 1;
-                    break;
-
-                case SDLK_4:
-                    key[0xC] = 1;
-                    break;
-
-                case SDLK_r:
-                    key[0xD] = 1;
-                    break;
-
-                case SDLK_f:
-                    key[0xE] = 1;
-                    break;
-
-                case SDLK_v:
-                    key[0xF] = 1;
-                    break;
-                }
-        }
-        if(event.type == SDL_KEYUP){
-            switch(event.key.keysym.sym){
-                case SDLK_x:
-                    key[0x0] = 0;
-                    break;
-
-                case SDLK_1:
-                    key[0x1] = 0;
-                    break;
-
-                case SDLK_2:
-                    key[0x2] = 0;
-                    break;
-
-                case SDLK_3:
-                    key[0x3] = 0;
-                    break;
-
-                case SDLK_q:
-                    key[0x4] = 0;
-                    break;
-
-                case SDLK_w:
-                    key[0x5] = 0;
-                    break;
-
-                case SDLK_e:
-                    key[0x6] = 0;
-                    break;
-
-                case SDLK_a:
-                    key[0x7] = 0;
-                    break;
-
-                case SDLK_s:
-                    key[0x8] = 0;
-                    break;
-
-                case SDLK_d:
-                    key[0x9] = 0;
-                    break;
-
-                case SDLK_z:
-                    key[0xA] = 0;
-                    break;
-
-                case SDLK_c:
-                    key[0xB] = 0;
-                    break;
-
-                case SDLK_4:
-                    key[0xC] = 0;
-                    break;
-
-                case SDLK_r:
-                    key[0xD] = 0;
-                    break;
-
-                case SDLK_f:
-                    key[0xE] = 0;
-                    break;
-
-                case SDLK_v:
-                    key[0xF] = 0;
-                    break;
+void chip8::run(uint64_t n, Engine engine){
+#ifdef CHIP8_PROFILE
+    // one instruction at a time so every handler is seen, no fusions or idle skipping
+    if(profile){
+        for(uint64_t i=0;i<n;i++)
+            emulateCycle();
+        return;
+    }
+#endif
+    switch(engine){
+        case Engine::Switch:
+            withQuirks(variant, [this, n](auto q){ runSwitch<decltype(q)>(n); });
+            break;
+        case Engine::Threaded:
+            withQuirks(variant, [this, n](auto q){ runThreaded<decltype(q)>(n); });
+            break;
+        case Engine::Specialized:
+#ifndef CHIP8_NO_SPECIALIZED
+            if(variant == Variant::Modern){
+                runSpecialized(n);
+                break;
+            }
+#endif
+            // no table for this variant (or none at all), threaded it is
+            withQuirks(variant, [this, n](auto q){ runThreaded<decltype(q)>(n); });
+            break;
+        default:
+            for(uint64_t i=0;i<n;){
+                // only the idle loops, the table engine runs no fusions
+                const Instr& in = fetch();
+                if(isIdle(in.fuse) && n - i >= fuseLength(in.fuse)){
+                    i += skipIdle(in, n - i);
+                    continue;
                 }
+                emulateCycle();
+                i++;
             }
-	}
+            break;
+    }
 }
-
-void Update(void const* buffer, int pitch, SDL_Renderer* renderer,SDL_Texture* texture){
-	SDL_UpdateTexture(texture, nullptr, buffer, pitch);
-	SDL_RenderClear(renderer);
-    SDL_RenderCopy(renderer, texture, nullptr, nullptr);
-    SDL_RenderPresent(renderer);
-}
\ No newline at end of file
@@ -0,0 +1,813 @@
+#ifndef CHIP8_H
+#define CHIP8_H
+
+// Interpreter core, no SDL in here so it can be used by the
+// headless runner and anything else that does not need a window
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#define startLocation 0x200
+#define maxRomSize (0x1000 - startLocation) // program area, 0xE00 bytes
+#define fontSetStart 0x50
+#define screen_width 64
+#define screen_height 32
+
+// engine used by chip8::run() when none is given, can be overridden at build time
+// e.g. -DCHIP8_DEFAULT_ENGINE=chip8::Engine::Threaded
+// building with -DCHIP8_NO_SPECIALIZED leaves spectable.cpp out, the
+// Specialized engine then falls back to Threaded
+#ifndef CHIP8_DEFAULT_ENGINE
+#define CHIP8_DEFAULT_ENGINE chip8::Engine::Table
+#endif
+
+extern uint8_t chip8_fontset[80];
+
+#ifdef CHIP8_PROFILE
+struct Chip8Profile;
+#endif
+
+class chip8{
+public:
+
+    // CHIP-8 variants disagree on a few instructions, each of these is one
+    // set of Quirks below. Modern is what this interpreter always did
+    enum class Variant : uint8_t { Modern, Cosmac, SuperChip, XoChip };
+    static constexpr int VARIANT_COUNT = 4;
+
+    // The registers and everything else touched on every instruction come
+    // first so they share a couple of cache lines, the big arrays follow
+
+    // 1 byte x 16 Registers
+    uint8_t V[16];
+
+    // 1 byte index register
+    uint16_t I;
+
+    // 2 byte program Counter
+    uint16_t pc;
+
+    // stack and stack pointer
+    uint16_t stack[16];
+    uint16_t sp;
+
+    uint16_t opcode;
+
+    uint8_t delayTimer;
+    uint8_t soundTimer;
+
+    // instructions per 60 Hz timer tick, at 1 the timers count down after
+    // every instruction, a frame paced frontend sets its instructions per frame
+    uint32_t timerPeriod;
+    uint32_t timerPhase; // instructions since the last tick
+
+    // xorshift32 state behind op_C, per instance so instances on different
+    // threads neither share nor race on the C library rand(). Set with seed()
+    uint32_t rngState;
+
+    // which quirks the handlers follow, read by run() and emulateCycle()
+    // to pick the handlers built for it
+    Variant variant;
+
+    // instructions executed since construction
+    uint64_t cycles;
+
+    // 1 byte x 16 gor keypad state
+    uint8_t keypad[16];
+
+    // one bit per gfx row changed since the frontend last presented, it
+    // clears the bits it uploaded
+    uint32_t dirtyRows;
+
+    // one bit per 64 byte page of memory written since loadProgram, lets
+    // compiled code (aot.h) tell cheaply whether it may have been written over
+    uint64_t dirtyPages;
+
+    // Called after op_Fx33, op_Fx55 or loadProgram write memory, lets
+    // translated code (the JIT) drop whatever it built from those bytes
+    typedef void (*WriteHook)(void* ctx, uint16_t addr, uint16_t len);
+    WriteHook writeHook;
+    void* writeHookCtx;
+
+    // Where the decode cache comes from, the slots of a shared Code except
+    // for the ones set in localSlots below, which come out of the overlay.
+    // With no code every slot is local
+    struct Code;
+    const Code* code;
+
+    //program memory location begins at 512 (0x200)
+    //The uppermost 256 bytes (0xF00-0xFFF)(3840-4095) are reserved for display refresh
+    // 0x050-0x0A0 - Used for the built in 4x5 pixel font set (0-F)
+    // 1 byte x 4K Memory
+    uint8_t memory[4096];
+
+    // 1 bit per pixel Video Memory (64 x 32), one word per row with the
+    // leftmost pixel in the top bit. expandFrame() turns it into RGBA
+    uint64_t gfx[screen_height];
+
+    // Every handler gets a small id, opId() maps an opcode to it. The switch,
+    // threaded and specialized engines dispatch on the id directly
+    enum OpId : uint8_t {
+        OP_NULL, OP_00E0, OP_00EE, OP_1, OP_2, OP_3, OP_4, OP_5, OP_6, OP_7,
+        OP_8xy0, OP_8xy1, OP_8xy2, OP_8xy3, OP_8xy4, OP_8xy5, OP_8xy6, OP_8xy7, OP_8xyE,
+        OP_9, OP_A, OP_B, OP_C, OP_D, OP_Ex9E, OP_ExA1,
+        OP_Fx07, OP_Fx0A, OP_Fx15, OP_Fx18, OP_Fx1E, OP_Fx29, OP_Fx33, OP_Fx55, OP_Fx65,
+        OP_COUNT
+    };
+
+    // Function Pointer setup
+    struct Instr;
+	typedef void (chip8::*Chip8Func)(const Instr&);
+    // if typedef is not used the syntax would be void (chip8::*handlers[OP_COUNT])(const Instr&);
+    // the table engine calls handlers[variant][id], one table per variant
+    // shared by every instance and filled in at compile time (chip8.cpp)
+    static const Chip8Func handlers[VARIANT_COUNT][OP_COUNT];
+
+    // The behaviour variants disagree on, as compile time policies. The
+    // handlers that care take one as a template parameter, so each variant
+    // gets its own handlers and engine loops with no quirk tested at run time
+    // ShiftVy     - 8xy6/8xyE shift Vy into Vx (COSMAC VIP), not Vx in place
+    // LoadStoreI  - Fx55/Fx65 leave I one past the last register (COSMAC VIP)
+    // JumpVx      - Bxnn jumps to xnn + Vx (SUPER-CHIP), not nnn + V0
+    // WrapSprites - Dxyn wraps sprites around the edges (XO-CHIP), not clipped
+    template<bool ShiftVy, bool LoadStoreI, bool JumpVx, bool WrapSprites>
+    struct Quirks{
+        static constexpr bool shiftVy = ShiftVy;
+        static constexpr bool loadStoreI = LoadStoreI;
+        static constexpr bool jumpVx = JumpVx;
+        static constexpr bool wrapSprites = WrapSprites;
+    };
+    typedef Quirks<false, false, false, false> ModernQuirks;
+    typedef Quirks<true, true, false, false> CosmacQuirks;
+    typedef Quirks<false, false, true, false> SuperChipQuirks;
+    typedef Quirks<true, true, false, true> XoChipQuirks;
+
+    // Calls f with the Quirks of v, where a variant picked at run time turns
+    // into the code built for it
+    template<typename F>
+    static void withQuirks(Variant v, F&& f){
+        switch(v){
+            case Variant::Cosmac: f(CosmacQuirks()); break;
+            case Variant::SuperChip: f(SuperChipQuirks()); break;
+            case Variant::XoChip: f(XoChipQuirks()); break;
+            default: f(ModernQuirks()); break;
+        }
+    }
+
+    // Dispatch backends, all of them run the same handlers below
+    // Table       - member pointers out of the decode cache (emulateCycle)
+    // Switch      - one switch on the decoded id
+    // Threaded    - computed goto threaded code, GCC and Clang only
+    // Specialized - 65536 entry table of handlers with the operands baked in
+    enum class Engine { Table, Switch, Threaded, Specialized };
+
+    // Short sequences the switch and threaded engines run as one handler
+    // (runFused), picked out in decode() from the bytes following the slot
+    // FUSE_6_D         - 6xkk Dxyn, sprite position setup then draw
+    // FUSE_7_SKIP_1    - 7xkk 3xkk/4xkk 1nnn, counter loop
+    // FUSE_Fx1E_Fx65.. - Fx65/Fx55 next to Fx1E, table walks
+    // The idle loops below are fast forwarded instead, the table engine
+    // takes those too. The skipped instructions still retire so cycles and
+    // the timers end up exactly where running them would have left them
+    // FUSE_IDLE_JUMP   - 1nnn to itself, nothing but the timers ever changes
+    // FUSE_IDLE_POLL   - Fx07 3x00 1nnn back to the Fx07, waits for the delay timer
+    // FUSE_IDLE_KEY    - Fx0A with no key down, waits for input
+    enum FuseId : uint8_t {
+        FUSE_NONE, FUSE_6_D, FUSE_7_SKIP_1,
+        FUSE_Fx1E_Fx65, FUSE_Fx1E_Fx55, FUSE_Fx65_Fx1E, FUSE_Fx55_Fx1E,
+        FUSE_IDLE_JUMP, FUSE_IDLE_POLL, FUSE_IDLE_KEY,
+        FUSE_COUNT
+    };
+
+    // A decoded instruction, the handler id and the operand fields are
+    // pulled out of the opcode once. 14 bytes
+    struct Instr{
+        uint16_t opcode;
+        uint16_t nnn;
+        uint16_t next[2]; // the two opcodes after this one, for fuse
+        uint8_t id; // OpId
+        uint8_t x;
+        uint8_t y;
+        uint8_t n;
+        uint8_t nn;
+        uint8_t fuse; // FuseId of the sequence starting here
+    };
+
+    // Predecoded instruction cache for a whole memory image, one slot per
+    // byte address since a jump can land on an odd address. decodeAll()
+    // fills one in and nothing writes it after that, so a single Code per
+    // ROM serves every instance running it (InstancePool, RomLibrary) and
+    // has to outlive them. About 61 KB
+    struct Code{
+        uint8_t memory[4096]; // what the slots were decoded from
+        Instr slots[4096];
+    };
+
+    // One bit per slot whose six bytes may no longer be what code was
+    // decoded from, set by invalidate() (op_Fx33, op_Fx55, loadProgram)
+    uint64_t localSlots[64];
+
+    // Per instance decodings of the local slots code ran from, direct
+    // mapped on the address and filled in on a miss. Self modifying ROMs
+    // write a handful of instructions, a slot two of them share only costs
+    // a decode now and then. An entry is good for the address in its tag
+    // while that slot's bit in localDecoded is set, writes just clear those
+    static constexpr int LOCAL_COUNT = 256;
+    uint64_t localDecoded[64];
+    uint16_t localTag[LOCAL_COUNT];
+    Instr local[LOCAL_COUNT];
+
+    // how many times each FuseId ran instead of separate dispatches
+    uint64_t fusions[FUSE_COUNT];
+    // instructions idle loops were fast forwarded over, part of cycles
+    uint64_t idleCycles;
+
+    // What rollingHash() keeps between calls: a hash per 64 byte page of
+    // memory and per gfx row, memHash and gfxHash being their XOR. Writers
+    // only mark what they changed in hashPages (invalidate() does it for
+    // memory) and hashRows next to dirtyRows, the next rollingHash()
+    // rehashes just those instead of the whole 4K. Kept past the overlay,
+    // away from the fields the handlers touch on every instruction
+    uint64_t hashPages;
+    uint32_t hashRows;
+    uint64_t pageHash[64];
+    uint64_t rowHash[screen_height];
+    uint64_t memHash;
+    uint64_t gfxHash;
+
+#ifdef CHIP8_PROFILE
+    // when set every instruction is counted into it, see profile.h
+    Chip8Profile* profile;
+#endif
+
+    chip8(){
+        memset(memory,0,sizeof(memory));
+        memset(V,0,sizeof(V));
+        memset(stack,0,sizeof(stack));
+        I = 0;
+        sp = 0;
+        opcode = 0;
+        delayTimer = 0;
+        soundTimer = 0;
+        timerPeriod = 1;
+        timerPhase = 0;
+        cycles = 0;
+        variant = Variant::Modern;
+        memset(fusions,0,sizeof(fusions));
+        idleCycles = 0;
+        writeHook = nullptr;
+        writeHookCtx = nullptr;
+        dirtyPages = 0;
+        code = nullptr;
+        memset(localSlots,0xFF,sizeof(localSlots));
+        memset(localDecoded,0,sizeof(localDecoded));
+        memset(localTag,0,sizeof(localTag));
+        memset(local,0,sizeof(local));
+#ifdef CHIP8_PROFILE
+        profile = nullptr;
+#endif
+
+        pc = startLocation;
+        seed(0);
+        for(int i=0;i<80;i++)
+            memory[i + fontSetStart] = chip8_fontset[i];
+
+        memset(keypad,0,sizeof(keypad));
+        memset(gfx,0,sizeof(gfx));
+        dirtyRows = 0xFFFFFFFF; // nothing has been shown yet
+        // nothing hashed yet either, all zeros XOR to the zero hashes
+        memset(pageHash,0,sizeof(pageHash));
+        memset(rowHash,0,sizeof(rowHash));
+        memHash = gfxHash = 0;
+        hashPages = ~0ull;
+        hashRows = 0xFFFFFFFF;
+        invalidate(0,sizeof(memory));
+        dirtyPages = 0;
+    }
+
+    // Decodes the instruction at addr of memory into in
+    static void decode(const uint8_t* memory, uint16_t addr, Instr& in){
+        uint16_t op = (memory[addr] << 8u) | memory[(addr + 1) & 0xFFF];
+        in.opcode = op;
+        in.nnn = op & 0x0FFF;
+        in.x = (op & 0x0F00) >> 8;
+        in.y = (op & 0x00F0) >> 4;
+        in.n = op & 0x000F;
+        in.nn = op & 0x00FF;
+        in.id = opId(op);
+
+        in.next[0] = (memory[(addr + 2) & 0xFFF] << 8u) | memory[(addr + 3) & 0xFFF];
+        in.next[1] = (memory[(addr + 4) & 0xFFF] << 8u) | memory[(addr + 5) & 0xFFF];
+        in.fuse = fuseId(addr, op, in.next[0], in.next[1]);
+    }
+
+    // Decodes all of memory as it is now into a Code and reads the cache
+    // from there, for images that get copied a lot (InstancePool::prime(),
+    // RomLibrary) so the copies start decoded and share it
+    void decodeAll(Code& into);
+
+    // Reads the cache from shared from now on, the slots whose bytes do
+    // not match it stay local. Also what brings slots back to it after
+    // memory was replaced wholesale (loadState())
+    void setCode(const Code* shared);
+
+    static constexpr uint8_t fuseId(uint16_t addr, uint16_t op, uint16_t op2, uint16_t op3){
+        return (op >> 12) == 0x1 && (op & 0x0FFF) == addr ? FUSE_IDLE_JUMP :
+               opId(op) == OP_Fx07 && (op2 & 0xF0FF) == 0x3000 && (op2 & 0x0F00) == (op & 0x0F00) &&
+                   op3 == (0x1000 | addr) ? FUSE_IDLE_POLL :
+               opId(op) == OP_Fx0A ? FUSE_IDLE_KEY :
+               (op >> 12) == 0x6 && (op2 >> 12) == 0xD ? FUSE_6_D :
+               (op >> 12) == 0x7 && ((op2 >> 12) == 0x3 || (op2 >> 12) == 0x4) && (op3 >> 12) == 0x1 ? FUSE_7_SKIP_1 :
+               opId(op) == OP_Fx1E && opId(op2) == OP_Fx65 ? FUSE_Fx1E_Fx65 :
+               opId(op) == OP_Fx1E && opId(op2) == OP_Fx55 ? FUSE_Fx1E_Fx55 :
+               opId(op) == OP_Fx65 && opId(op2) == OP_Fx1E ? FUSE_Fx65_Fx1E :
+               opId(op) == OP_Fx55 && opId(op2) == OP_Fx1E ? FUSE_Fx55_Fx1E :
+               FUSE_NONE;
+    }
+
+    // budget the engines need left before taking the fused path, the most
+    // instructions a fusion runs or one pass of an idle loop
+    static constexpr uint32_t fuseLength(uint8_t fuse){
+        return fuse == FUSE_7_SKIP_1 || fuse == FUSE_IDLE_POLL ? 3 :
+               fuse == FUSE_IDLE_JUMP || fuse == FUSE_IDLE_KEY ? 1 : 2;
+    }
+
+    static constexpr bool isIdle(uint8_t fuse){
+        return fuse >= FUSE_IDLE_JUMP;
+    }
+
+    // Unknown opcodes map to OP_NULL, evaluated at compile time where op is a constant
+    static constexpr uint8_t opId(uint16_t op){
+        switch(op >> 12){
+            case 0x0:
+                if((op & 0x000F) == 0x0) return OP_00E0;
+                if((op & 0x000F) == 0xE) return OP_00EE;
+                return OP_NULL;
+            case 0x1: return OP_1;
+            case 0x2: return OP_2;
+            case 0x3: return OP_3;
+            case 0x4: return OP_4;
+            case 0x5: return OP_5;
+            case 0x6: return OP_6;
+            case 0x7: return OP_7;
+            case 0x8:
+                switch(op & 0x000F){
+                    case 0x0: return OP_8xy0;
+                    case 0x1: return OP_8xy1;
+                    case 0x2: return OP_8xy2;
+                    case 0x3: return OP_8xy3;
+                    case 0x4: return OP_8xy4;
+                    case 0x5: return OP_8xy5;
+                    case 0x6: return OP_8xy6;
+                    case 0x7: return OP_8xy7;
+                    case 0xE: return OP_8xyE;
+                }
+                return OP_NULL;
+            case 0x9: return OP_9;
+            case 0xA: return OP_A;
+            case 0xB: return OP_B;
+            case 0xC: return OP_C;
+            case 0xD: return OP_D;
+            case 0xE:
+                if((op & 0x000F) == 0x1) return OP_ExA1;
+                if((op & 0x000F) == 0xE) return OP_Ex9E;
+                return OP_NULL;
+            default:
+                switch(op & 0x00FF){
+                    case 0x07: return OP_Fx07;
+                    case 0x0A: return OP_Fx0A;
+                    case 0x15: return OP_Fx15;
+                    case 0x18: return OP_Fx18;
+                    case 0x1E: return OP_Fx1E;
+                    case 0x29: return OP_Fx29;
+                    case 0x33: return OP_Fx33;
+                    case 0x55: return OP_Fx55;
+                    case 0x65: return OP_Fx65;
+                }
+                return OP_NULL;
+        }
+    }
+
+    // Builds a decoded instruction without touching memory, used where the
+    // opcode is a compile time constant (the specialized engine)
+    static constexpr Instr makeInstr(uint16_t op){
+        return Instr{op, (uint16_t)(op & 0x0FFF), {0, 0}, opId(op),
+                     (uint8_t)((op & 0x0F00) >> 8), (uint8_t)((op & 0x00F0) >> 4),
+                     (uint8_t)(op & 0x000F), (uint8_t)(op & 0x00FF), FUSE_NONE};
+    }
+
+    // The cache slot for addr, decoded first if it has to be
+    const Instr& fetch(uint16_t addr){
+        const uint64_t bit = 1ull << (addr & 63);
+        if(!(localSlots[addr >> 6] & bit))
+            return code->slots[addr];
+        Instr& in = local[addr % LOCAL_COUNT];
+        if(localTag[addr % LOCAL_COUNT] != addr || !(localDecoded[addr >> 6] & bit)){
+            decode(memory, addr, in);
+            localTag[addr % LOCAL_COUNT] = addr;
+            localDecoded[addr >> 6] |= bit;
+        }
+        return in;
+    }
+
+    const Instr& fetch(){
+        return fetch(pc & 0xFFF);
+    }
+
+    // splitmix64 finalizer, behind the page and row hashes
+    static constexpr uint64_t mix64(uint64_t x){
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+        return x ^ (x >> 31);
+    }
+
+    // Restarts the op_C sequence, the same seed gives the same numbers on
+    // every host. The seed is mixed first so nearby seeds do not start out
+    // alike, and kept off 0 which xorshift never leaves
+    void seed(uint32_t s){
+        s += 0x9E3779B9u;
+        s = (s ^ (s >> 16)) * 0x85EBCA6Bu;
+        s = (s ^ (s >> 13)) * 0xC2B2AE35u;
+        s ^= s >> 16;
+        rngState = s ? s : 0x2545F491;
+    }
+
+    uint32_t random(){
+        rngState ^= rngState << 13;
+        rngState ^= rngState >> 17;
+        rngState ^= rngState << 5;
+        return rngState;
+    }
+
+    // Counts both timers down by ticks 60 Hz periods
+    void tickTimers(uint32_t ticks = 1){
+        delayTimer = delayTimer > ticks ? delayTimer - ticks : 0;
+        soundTimer = soundTimer > ticks ? soundTimer - ticks : 0;
+    }
+
+    // Work done after every instruction whatever engine ran it
+    void retire(){
+        if (++timerPhase >= timerPeriod){
+            timerPhase = 0;
+            tickTimers();
+        }
+        ++cycles;
+    }
+
+    // Same as retire() for n instructions run back to back by translated
+    // code or skipped over by skipIdle()
+    void retire(uint64_t n){
+        uint64_t phase = timerPhase + n;
+        if (phase >= timerPeriod){
+            uint64_t ticks = phase / timerPeriod;
+            phase -= ticks * timerPeriod;
+            tickTimers(ticks > 0xFF ? 0xFF : (uint32_t)ticks);
+        }
+        timerPhase = (uint32_t)phase;
+        cycles += n;
+    }
+
+    // Runs the handler for in.id, inlined into the switch engine and, with
+    // a constant Instr, folded down to a single handler by the specialized one
+    template<class Q>
+    void exec(const Instr& in){
+        switch(in.id){
+            case OP_00E0: op_00E0(in); break;
+            case OP_00EE: op_00EE(in); break;
+            case OP_1: op_1(in); break;
+            case OP_2: op_2(in); break;
+            case OP_3: op_3(in); break;
+            case OP_4: op_4(in); break;
+            case OP_5: op_5(in); break;
+            case OP_6: op_6(in); break;
+            case OP_7: op_7(in); break;
+            case OP_8xy0: op_8xy0(in); break;
+            case OP_8xy1: op_8xy1(in); break;
+            case OP_8xy2: op_8xy2(in); break;
+            case OP_8xy3: op_8xy3(in); break;
+            case OP_8xy4: op_8xy4(in); break;
+            case OP_8xy5: op_8xy5(in); break;
+            case OP_8xy6: op_8xy6<Q>(in); break;
+            case OP_8xy7: op_8xy7(in); break;
+            case OP_8xyE: op_8xyE<Q>(in); break;
+            case OP_9: op_9(in); break;
+            case OP_A: op_A(in); break;
+            case OP_B: op_B<Q>(in); break;
+            case OP_C: op_C(in); break;
+            case OP_D: op_D<Q>(in); break;
+            case OP_Ex9E: op_Ex9E(in); break;
+            case OP_ExA1: op_ExA1(in); break;
+            case OP_Fx07: op_Fx07(in); break;
+            case OP_Fx0A: op_Fx0A(in); break;
+            case OP_Fx15: op_Fx15(in); break;
+            case OP_Fx18: op_Fx18(in); break;
+            case OP_Fx1E: op_Fx1E(in); break;
+            case OP_Fx29: op_Fx29(in); break;
+            case OP_Fx33: op_Fx33(in); break;
+            case OP_Fx55: op_Fx55<Q>(in); break;
+            case OP_Fx65: op_Fx65<Q>(in); break;
+            default: break;
+        }
+    }
+
+    // Runs the sequence starting at pc that in (its cache slot) was fused
+    // from, returns how many instructions that turned out to be. Idle loops
+    // skip ahead as far as budget allows
+    template<class Q>
+    uint64_t runFused(const Instr& in, uint64_t budget);
+    uint64_t skipIdle(const Instr& in, uint64_t budget);
+
+    // Drops the cache slots that read any byte of memory[addr, addr+len),
+    // they turn local and get decoded again from memory the next time
+    // a slot looks at six bytes (itself and next[]) so the five before addr go too
+    void invalidate(uint16_t addr, uint16_t len){
+        for(int a = addr - 5; a < addr + len;){
+            // a word of slot bits at a time
+            const int slot = a & 0xFFF;
+            const int n = 64 - (slot & 63) < addr + len - a ? 64 - (slot & 63) : addr + len - a;
+            const uint64_t bits = (~0ull >> (64 - n)) << (slot & 63);
+            localSlots[slot >> 6] |= bits;
+            localDecoded[slot >> 6] &= ~bits;
+            a += n;
+        }
+        uint64_t pages = 1ull << (((addr + len - 1) & 0xFFF) >> 6);
+        for(int a = addr; a < addr + len; a += 64)
+            pages |= 1ull << ((a & 0xFFF) >> 6);
+        dirtyPages |= pages;
+        hashPages |= pages;
+        if(writeHook)
+            writeHook(writeHookCtx,addr,len);
+    }
+
+    void op_NULL(const Instr&){}
+
+
+    // Instructions Below
+    // Reference ==> http://devernay.free.fr/hacks/chip8/C8TECH10.HTM
+    void op_00E0(const Instr&){
+        for(int row=0;row<screen_height;row++){
+            if(gfx[row]){
+                dirtyRows |= 1u << row;
+                hashRows |= 1u << row;
+            }
+        }
+        memset(gfx,0,sizeof(gfx));
+    }
+
+    void op_00EE(const Instr&){
+        --sp;
+	    pc = stack[sp];
+    }
+
+    void op_1(const Instr& in){
+        pc = in.nnn;
+    }
+
+    void op_2(const Instr& in){
+        stack[sp] = pc;
+        sp++;
+        pc = in.nnn;
+    }
+
+    void op_3(const Instr& in){
+        if(V[in.x] == in.nn)
+            pc += 2;
+    }
+
+    void op_4(const Instr& in){
+        if(V[in.x] != in.nn)
+            pc += 2;
+    }
+
+    void op_5(const Instr& in){
+        if(V[in.x] == V[in.y])
+            pc += 2;
+    }
+
+    void op_6(const Instr& in){
+        V[in.x] = in.nn;
+    }
+
+    void op_7(const Instr& in){
+        V[in.x] += in.nn;
+    }
+
+    void op_8xy0(const Instr& in){
+        V[in.x] = V[in.y];
+    }
+
+    void op_8xy1(const Instr& in){
+        V[in.x] |= V[in.y];
+    }
+
+    void op_8xy2(const Instr& in){
+        V[in.x] &= V[in.y];
+    }
+
+    void op_8xy3(const Instr& in){
+        V[in.x] ^= V[in.y];
+    }
+
+    void op_8xy4(const Instr& in){
+        if(V[in.y] > (0xFF - V[in.x]))
+            V[0xF] = 1;
+        else
+            V[0xF] = 0;
+        V[in.x] += V[in.y];
+    }
+
+    void op_8xy5(const Instr& in){
+        if(V[in.x] > V[in.y])
+            V[0xF] = 1;
+        else
+            V[0xF] = 0;
+        V[in.x] -= V[in.y];
+    }
+
+    template<class Q>
+    void op_8xy6(const Instr& in){
+        const uint8_t src = V[Q::shiftVy ? in.y : in.x];
+        V[0xF] = src & 0x1;
+        V[in.x] = src >> 1;
+    }
+
+    void op_8xy7(const Instr& in){
+        if(V[in.y] > V[in.x])
+            V[0xF] = 1;
+        else
+            V[0xF] = 0;
+        V[in.x] = V[in.y] - V[in.x];
+    }
+
+    template<class Q>
+    void op_8xyE(const Instr& in){
+        const uint8_t src = V[Q::shiftVy ? in.y : in.x];
+        V[0xF] = src >> 7;
+        V[in.x] = src << 1;
+    }
+
+    void op_9(const Instr& in){
+        if(V[in.x] != V[in.y])
+            pc += 2;
+    }
+
+    void op_A(const Instr& in){
+        I = in.nnn;
+    }
+
+    template<class Q>
+    void op_B(const Instr& in){
+        pc = in.nnn + V[Q::jumpVx ? in.x : 0];
+    }
+
+    void op_C(const Instr& in){
+        // top byte of the state, its best mixed bits and any of 0-255
+        V[in.x] = (random() >> 24) & in.nn;
+    }
+
+    // Taken this func from online reference
+    template<class Q>
+    void op_D(const Instr& in){
+        uint8_t height = in.n;
+
+        // Wrap the start position, the sprite itself is clipped at the edges
+        // unless the variant wraps it round as well
+        uint8_t xPos = V[in.x] % screen_width;
+        uint8_t yPos = V[in.y] % screen_height;
+
+        V[0xF] = 0;
+
+        for (unsigned int row = 0; row < height && (Q::wrapSprites || yPos + row < screen_height); ++row){
+            // the whole sprite row lined up with the screen row, bits past
+            // the right edge fall off the end of the shift or come back
+            // round on the left
+            uint64_t bits = (uint64_t)memory[(I + row) & 0xFFF] << 56;
+            uint64_t spriteRow = Q::wrapSprites ? bits >> xPos | bits << ((64 - xPos) & 63) : bits >> xPos;
+            const unsigned int y = (yPos + row) % screen_height;
+            uint64_t& screenRow = gfx[y];
+
+            // Screen pixel also on - collision
+            if (screenRow & spriteRow)
+                V[0xF] = 1;
+            screenRow ^= spriteRow;
+            if (spriteRow){
+                dirtyRows |= 1u << y;
+                hashRows |= 1u << y;
+            }
+        }
+    }
+
+    void op_Ex9E(const Instr& in){
+        if(keypad[V[in.x]])
+            pc += 2;
+    }
+
+    void op_ExA1(const Instr& in){
+        if(!keypad[V[in.x]])
+            pc += 2;
+    }
+
+    void op_Fx07(const Instr& in){
+        V[in.x] = delayTimer;
+    }
+
+    void op_Fx0A(const Instr& in){
+        uint8_t Vx = in.x;
+        if(keypad[0]) V[Vx] = 0;
+        else if(keypad[1]) V[Vx] = 1;
+        else if(keypad[2]) V[Vx] = 2;
+        else if(keypad[3]) V[Vx] = 3;
+        else if(keypad[4]) V[Vx] = 4;
+        else if(keypad[5]) V[Vx] = 5;
+        else if(keypad[6]) V[Vx] = 6;
+        else if(keypad[7]) V[Vx] = 7;
+        else if(keypad[8]) V[Vx] = 8;
+        else if(keypad[9]) V[Vx] = 9;
+        else if(keypad[10]) V[Vx] = 10;
+        else if(keypad[11]) V[Vx] = 11;
+        else if(keypad[12]) V[Vx] = 12;
+        else if(keypad[13]) V[Vx] = 13;
+        else if(keypad[14]) V[Vx] = 14;
+        else if(keypad[15]) V[Vx] = 15;
+        else pc -= 2;
+    }
+
+    void op_Fx15(const Instr& in){
+        delayTimer = V[in.x];
+    }
+
+    void op_Fx18(const Instr& in){
+        soundTimer = V[in.x];
+    }
+
+    void op_Fx1E(const Instr& in){
+        I += V[in.x];
+    }
+
+    void op_Fx29(const Instr& in){
+        I = fontSetStart + (V[in.x] * 5);
+    }
+
+    // I can point anywhere in 16 bits (Fx1E, loadStoreI), memory wraps at 4K like in op_D
+    void op_Fx33(const Instr& in){
+        uint8_t val = V[in.x];
+        memory[(I + 2) & 0xFFF] = val%10;
+        val /= 10;
+        memory[(I + 1) & 0xFFF] = val%10;
+        val /= 10;
+        memory[I & 0xFFF] = val%10;
+        invalidate(I & 0xFFF,3);
+    }
+
+    template<class Q>
+    void op_Fx55(const Instr& in){
+        for(uint8_t i=0;i<=in.x;i++)
+            memory[(I + i) & 0xFFF] = V[i];
+        invalidate(I & 0xFFF,in.x + 1);
+        if(Q::loadStoreI)
+            I += in.x + 1;
+    }
+
+    template<class Q>
+    void op_Fx65(const Instr& in){
+        for(uint8_t i=0;i <= in.x;i++)
+            V[i] = memory[(I + i) & 0xFFF];
+        if(Q::loadStoreI)
+            I += in.x + 1;
+    }
+
+    // Member Functions Defined Outside
+    bool loadProgram(const char* fileName); // Loads File into Memory, false if it can not be read or does not fit
+    bool loadProgram(const uint8_t* data, size_t size); // Loads a ROM already in memory, false if more than maxRomSize
+    uint64_t hashState() const; // FNV-1a over the whole machine state
+    uint64_t rollingHash(); // hash of the same state from the pages and rows changed since the last call, cheap enough to take every few hundred instructions
+    void forkFrom(const chip8& parent); // becomes a copy of parent without its write hook, much cheaper than a plain copy when this already ran the same ROM
+    void expandFrame(uint32_t* pixels) const; // gfx as 64x32 RGBA8888, 0xFFFFFFFF for a lit pixel
+    static void expandRows(const uint64_t* rows, uint32_t* pixels, int first, int count); // same for rows [first, first+count) of a copy of gfx, pixels points at the first one
+    void emulateCycle(); // Emulates one cycle
+    void run(uint64_t n, Engine engine = CHIP8_DEFAULT_ENGINE); // Emulates n cycles back to back
+
+    // Engine loops, defined in dispatch.cpp and spectable.cpp, the first two
+    // built for every Quirks. The specialized table is only built for Modern
+    template<class Q> void runSwitch(uint64_t n);
+    template<class Q> void runThreaded(uint64_t n);
+    void runSpecialized(uint64_t n);
+};
+
+// Specialized handlers, one per opcode indexed [opcode >> 8][opcode & 0xFF]
+// filled in at compile time by spectable.cpp
+typedef void (*Chip8SpecFunc)(chip8&);
+typedef std::array<std::array<Chip8SpecFunc, 0x100>, 0x100> Chip8SpecTable;
+extern const Chip8SpecTable chip8_spectable;
+
+// printable names for chip8::FuseId, for the counters in chip8::fusions
+extern const char* const chip8_fusenames[chip8::FUSE_COUNT];
+// handler names for chip8::OpId
+extern const char* const chip8_opnames[chip8::OP_COUNT];
+// command line names for chip8::Variant, "modern", "cosmac", "schip", "xochip"
+extern const char* const chip8_variantnames[chip8::VARIANT_COUNT];
+// false if name is none of chip8_variantnames
+bool chip8_parseVariant(const char* name, chip8::Variant& variant);
+
+#endif
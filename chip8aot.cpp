@@ -0,0 +1,291 @@
+// Ahead of time recompiler, turns a ROM into a C++ file that runs it natively
+// against the chip8 state (see aot.h)
+//
+// usage: chip8aot <rom> <out.cpp> [name] [-variant modern|cosmac|schip|xochip]
+//
+// The code is compiled for one variant's quirks (see chip8::Quirks), it is
+// only picked for instances of that variant.
+//
+// Control flow is recovered by following jumps, calls and skips from
+// startLocation. Every instruction reached becomes a label running its
+// handler with constant operands, 1nnn/2nnn/skips turn into direct gotos and
+// 00EE/Bnnn go through a switch on pc over every label found. Anything
+// not found this way is left to the interpreter at run time.
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include "chip8.h"
+
+static std::string hex(unsigned v, int digits){
+    char buf[16];
+    snprintf(buf,sizeof(buf),"0x%0*X",digits,v);
+    return buf;
+}
+
+static std::string label(uint16_t addr){
+    char buf[16];
+    snprintf(buf,sizeof(buf),"L_%03X",addr);
+    return buf;
+}
+
+// Member function each instruction id is compiled to, indexed by chip8::OpId
+static const char* const handlers[chip8::OP_COUNT] = {
+    "op_NULL", "op_00E0", "op_00EE", "op_1", "op_2", "op_3", "op_4", "op_5", "op_6", "op_7",
+    "op_8xy0", "op_8xy1", "op_8xy2", "op_8xy3", "op_8xy4", "op_8xy5", "op_8xy6<Q>", "op_8xy7", "op_8xyE<Q>",
+    "op_9", "op_A", "op_B<Q>", "op_C", "op_D<Q>", "op_Ex9E", "op_ExA1",
+    "op_Fx07", "op_Fx0A", "op_Fx15", "op_Fx18", "op_Fx1E", "op_Fx29", "op_Fx33", "op_Fx55<Q>", "op_Fx65<Q>",
+};
+
+// Indexed by chip8::Variant, the -variant name, the enumerator and the Quirks
+// the generated code is built with (Q above)
+static const char* const variants[chip8::VARIANT_COUNT][3] = {
+    {"modern", "chip8::Variant::Modern", "chip8::ModernQuirks"},
+    {"cosmac", "chip8::Variant::Cosmac", "chip8::CosmacQuirks"},
+    {"schip", "chip8::Variant::SuperChip", "chip8::SuperChipQuirks"},
+    {"xochip", "chip8::Variant::XoChip", "chip8::XoChipQuirks"},
+};
+
+// Instructions that read or move pc, they need it set before the handler runs
+static bool usesPc(uint8_t id){
+    switch(id){
+        case chip8::OP_00EE: case chip8::OP_1: case chip8::OP_2: case chip8::OP_3:
+        case chip8::OP_4: case chip8::OP_5: case chip8::OP_9: case chip8::OP_B:
+        case chip8::OP_Ex9E: case chip8::OP_ExA1: case chip8::OP_Fx0A:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Short mnemonic for the comment next to each instruction
+static std::string disasm(uint16_t op){
+    chip8::Instr in = chip8::makeInstr(op);
+    char buf[32];
+    switch(in.id){
+        case chip8::OP_00E0: return "CLS";
+        case chip8::OP_00EE: return "RET";
+        case chip8::OP_1: snprintf(buf,sizeof(buf),"JP %03X",in.nnn); break;
+        case chip8::OP_2: snprintf(buf,sizeof(buf),"CALL %03X",in.nnn); break;
+        case chip8::OP_3: snprintf(buf,sizeof(buf),"SE V%X, %02X",in.x,in.nn); break;
+        case chip8::OP_4: snprintf(buf,sizeof(buf),"SNE V%X, %02X",in.x,in.nn); break;
+        case chip8::OP_5: snprintf(buf,sizeof(buf),"SE V%X, V%X",in.x,in.y); break;
+        case chip8::OP_6: snprintf(buf,sizeof(buf),"LD V%X, %02X",in.x,in.nn); break;
+        case chip8::OP_7: snprintf(buf,sizeof(buf),"ADD V%X, %02X",in.x,in.nn); break;
+        case chip8::OP_8xy0: snprintf(buf,sizeof(buf),"LD V%X, V%X",in.x,in.y); break;
+        case chip8::OP_8xy1: snprintf(buf,sizeof(buf),"OR V%X, V%X",in.x,in.y); break;
+        case chip8::OP_8xy2: snprintf(buf,sizeof(buf),"AND V%X, V%X",in.x,in.y); break;
+        case chip8::OP_8xy3: snprintf(buf,sizeof(buf),"XOR V%X, V%X",in.x,in.y); break;
+        case chip8::OP_8xy4: snprintf(buf,sizeof(buf),"ADD V%X, V%X",in.x,in.y); break;
+        case chip8::OP_8xy5: snprintf(buf,sizeof(buf),"SUB V%X, V%X",in.x,in.y); break;
+        case chip8::OP_8xy6: snprintf(buf,sizeof(buf),"SHR V%X",in.x); break;
+        case chip8::OP_8xy7: snprintf(buf,sizeof(buf),"SUBN V%X, V%X",in.x,in.y); break;
+        case chip8::OP_8xyE: snprintf(buf,sizeof(buf),"SHL V%X",in.x); break;
+        case chip8::OP_9: snprintf(buf,sizeof(buf),"SNE V%X, V%X",in.x,in.y); break;
+        case chip8::OP_A: snprintf(buf,sizeof(buf),"LD I, %03X",in.nnn); break;
+        case chip8::OP_B: snprintf(buf,sizeof(buf),"JP V0, %03X",in.nnn); break;
+        case chip8::OP_C: snprintf(buf,sizeof(buf),"RND V%X, %02X",in.x,in.nn); break;
+        case chip8::OP_D: snprintf(buf,sizeof(buf),"DRW V%X, V%X, %X",in.x,in.y,in.n); break;
+        case chip8::OP_Ex9E: snprintf(buf,sizeof(buf),"SKP V%X",in.x); break;
+        case chip8::OP_ExA1: snprintf(buf,sizeof(buf),"SKNP V%X",in.x); break;
+        case chip8::OP_Fx07: snprintf(buf,sizeof(buf),"LD V%X, DT",in.x); break;
+        case chip8::OP_Fx0A: snprintf(buf,sizeof(buf),"LD V%X, K",in.x); break;
+        case chip8::OP_Fx15: snprintf(buf,sizeof(buf),"LD DT, V%X",in.x); break;
+        case chip8::OP_Fx18: snprintf(buf,sizeof(buf),"LD ST, V%X",in.x); break;
+        case chip8::OP_Fx1E: snprintf(buf,sizeof(buf),"ADD I, V%X",in.x); break;
+        case chip8::OP_Fx29: snprintf(buf,sizeof(buf),"LD F, V%X",in.x); break;
+        case chip8::OP_Fx33: snprintf(buf,sizeof(buf),"LD B, V%X",in.x); break;
+        case chip8::OP_Fx55: snprintf(buf,sizeof(buf),"LD [I], V%X",in.x); break;
+        case chip8::OP_Fx65: snprintf(buf,sizeof(buf),"LD V%X, [I]",in.x); break;
+        default: return "undefined";
+    }
+    return buf;
+}
+
+int main(int argc, char* argv[]){
+    std::vector<const char*> args;
+    int variant = 0;
+    for(int i=1;i<argc;i++){
+        if(!strcmp(argv[i],"-variant") && i+1 < argc){
+            const char* v = argv[++i];
+            for(variant=0;variant<chip8::VARIANT_COUNT && strcmp(v,variants[variant][0]);variant++)
+                ;
+            if(variant == chip8::VARIANT_COUNT){
+                std::cerr << "unknown variant " << v << std::endl;
+                return 1;
+            }
+        }
+        else
+            args.push_back(argv[i]);
+    }
+    if(args.size() < 2){
+        std::cerr << "usage: " << argv[0] << " <rom> <out.cpp> [name] [-variant modern|cosmac|schip|xochip]" << std::endl;
+        return 1;
+    }
+    std::ifstream f(args[0], std::ios::binary);
+    if(!f){
+        std::cerr << "could not open " << args[0] << std::endl;
+        return 1;
+    }
+    std::vector<uint8_t> rom((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+    if(rom.empty() || rom.size() > 4096 - startLocation){
+        std::cerr << args[0] << " does not fit in chip8 memory" << std::endl;
+        return 1;
+    }
+    std::string name;
+    for(const char* p = args.size() > 2 ? args[2] : args[0]; *p; p++){
+        if(*p == '"' || *p == '\\')
+            name += '\\';
+        name += *p;
+    }
+
+    const uint16_t romEnd = startLocation + rom.size();
+    auto opAt = [&](uint16_t addr){
+        return (uint16_t)(rom[addr - startLocation] << 8 | rom[addr + 1 - startLocation]);
+    };
+    // an instruction can only be compiled if both of its bytes come from the ROM
+    auto inRom = [&](uint16_t addr){
+        return addr >= startLocation && addr + 1 < romEnd;
+    };
+
+    // recursive traversal from the entry point
+    std::vector<bool> reached(4096,false);
+    std::vector<uint16_t> work;
+    work.push_back(startLocation);
+    while(!work.empty()){
+        uint16_t addr = work.back();
+        work.pop_back();
+        if(!inRom(addr) || reached[addr])
+            continue;
+        reached[addr] = true;
+
+        chip8::Instr in = chip8::makeInstr(opAt(addr));
+        switch(in.id){
+            case chip8::OP_1: work.push_back(in.nnn); break;
+            case chip8::OP_2: work.push_back(in.nnn); work.push_back(addr + 2); break;
+            case chip8::OP_3: case chip8::OP_4: case chip8::OP_5: case chip8::OP_9:
+            case chip8::OP_Ex9E: case chip8::OP_ExA1:
+                work.push_back(addr + 2);
+                work.push_back(addr + 4);
+                break;
+            case chip8::OP_00EE: case chip8::OP_B: break;
+            default: work.push_back(addr + 2); break;
+        }
+    }
+
+    // bytes the generated code depends on, one bit per address
+    uint64_t codeMap[64] = {};
+    bool needDispatch = false;
+    for(uint16_t a=startLocation;a<romEnd;a++){
+        if(!reached[a])
+            continue;
+        codeMap[a / 64] |= 1ull << (a % 64);
+        codeMap[(a + 1) / 64] |= 1ull << ((a + 1) % 64);
+        uint8_t id = chip8::opId(opAt(a));
+        needDispatch = needDispatch || id == chip8::OP_00EE || id == chip8::OP_B;
+    }
+
+    std::ofstream out(args[1]);
+    if(!out){
+        std::cerr << "could not write " << args[1] << std::endl;
+        return 1;
+    }
+
+    out << "// generated by chip8aot from " << args[0] << ", do not edit\n";
+    out << "#include \"aot.h\"\n\n";
+    out << "namespace {\n\n";
+    out << "typedef " << variants[variant][2] << " Q;\n\n";
+    out << "const uint8_t rom[] = {";
+    for(size_t i=0;i<rom.size();i++)
+        out << (i % 16 ? " " : "\n    ") << hex(rom[i],2) << ",";
+    out << "\n};\n\n";
+
+    out << "const uint64_t codeMap[64] = {";
+    for(int i=0;i<64;i++){
+        char buf[24];
+        snprintf(buf,sizeof(buf),"0x%016llXull,",(unsigned long long)codeMap[i]);
+        out << (i % 4 ? " " : "\n    ") << buf;
+    }
+    out << "\n};\n\n";
+
+    out << "uint64_t run(chip8& c, uint64_t n){\n";
+    out << "    uint64_t done = 0, synced = 0;\n";
+    out << "    bool checked = aotCodeModified(c, codeMap, rom);\n\n";
+    if(needDispatch)
+        out << "dispatch:\n";
+    out << "    switch(c.pc){\n";
+    for(uint16_t a=startLocation;a<romEnd;a++)
+        if(reached[a])
+            out << "        case " << hex(a,3) << ": goto " << label(a) << ";\n";
+    out << "        default: goto out;\n";
+    out << "    }\n\n";
+
+    // where control goes once an instruction is done
+    auto jump = [&](uint16_t target){
+        if(inRom(target) && reached[target])
+            return "goto " + label(target) + ";";
+        return "CHIP8_AOT_EXIT(" + hex(target,3) + ")";
+    };
+
+    for(uint16_t a=startLocation;a<romEnd;a++){
+        if(!reached[a])
+            continue;
+        uint16_t op = opAt(a);
+        chip8::Instr in = chip8::makeInstr(op);
+        out << label(a) << ": // " << disasm(op) << "\n";
+        if(in.id == chip8::OP_Fx07 || in.id == chip8::OP_Fx15 || in.id == chip8::OP_Fx18)
+            out << "    CHIP8_AOT_SYNC()\n";
+        out << "    " << (usesPc(in.id) ? "CHIP8_AOT_STEP_PC(" : "CHIP8_AOT_STEP(")
+            << hex(a,3) << ", " << hex(op,4) << ", " << handlers[in.id] << ")\n";
+
+        switch(in.id){
+            case chip8::OP_1: case chip8::OP_2:
+                out << "    " << jump(in.nnn) << "\n";
+                break;
+            case chip8::OP_3: case chip8::OP_4: case chip8::OP_5: case chip8::OP_9:
+            case chip8::OP_Ex9E: case chip8::OP_ExA1:
+                out << "    if(c.pc == " << hex(a + 4,3) << ") " << jump(a + 4) << "\n";
+                out << "    " << jump(a + 2) << "\n";
+                break;
+            case chip8::OP_Fx0A:
+                // waiting on a key puts pc back on this instruction
+                out << "    if(c.pc == " << hex(a,3) << ") " << jump(a) << "\n";
+                out << "    " << jump(a + 2) << "\n";
+                break;
+            case chip8::OP_00EE: case chip8::OP_B:
+                out << "    goto dispatch;\n";
+                break;
+            default: {
+                if(in.id == chip8::OP_Fx33 || in.id == chip8::OP_Fx55)
+                    out << "    CHIP8_AOT_WROTE()\n";
+                // falls through when a + 2 is the next label written out
+                uint16_t next = a + 1;
+                while(next < romEnd && !reached[next])
+                    next++;
+                if(next != a + 2 || !inRom(next))
+                    out << "    " << jump(a + 2) << "\n";
+                break;
+            }
+        }
+        out << "\n";
+    }
+    out << "out:\n";
+    out << "    CHIP8_AOT_SYNC()\n";
+    out << "    return done;\n";
+    out << "}\n\n";
+
+    out << "AotProgram program = {\"" << name << "\", rom, sizeof(rom), " << variants[variant][1] << ", run, nullptr};\n";
+    out << "AotRegistrar registrar(program);\n\n";
+    out << "}\n";
+
+    std::cerr << args[0] << ": ";
+    size_t count = 0;
+    for(bool r : reached)
+        count += r;
+    std::cerr << count << " instructions compiled" << std::endl;
+    return 0;
+}
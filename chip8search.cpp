@@ -0,0 +1,182 @@
+// Searches for keypad input that gets a ROM the highest score, across all
+// cores, and reports how many forks a second the search went through
+//
+// usage: chip8search <rom> [-beam n] [-children n] [-rounds n] [-frames n] [-hold n] [-ipf n] [-keys mask] [-score what] [-j threads] [-e engine] [-seed n] [-variant v] [-o inputlog]
+// see search.h for what beam, children, rounds, frames and hold mean,
+// -keys is a hex mask of the keys the search may press (bit k for key k)
+// -score is what gets maximised: vX for a register, addr or addr:len for
+// len bytes of memory read as a big endian number (BCD digits stored with
+// Fx33 compare fine like that), the number of lit pixels if not given
+// -o writes the best input found as an input log that headless -replay and
+// batchrun take, the timers tick once per frame like in headless -f
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include "chip8.h"
+#include "romfile.h"
+#include "inputlog.h"
+#include "search.h"
+
+static void usage(const char* name){
+    std::cerr << "usage: " << name << " <rom> [-beam n] [-children n] [-rounds n] [-frames n] [-hold n] [-ipf n] [-keys mask] [-score vX|addr[:len]] [-j threads] [-e table|switch|threaded|specialized] [-seed n] [-variant modern|cosmac|schip|xochip] [-o inputlog]" << std::endl;
+}
+
+static bool parseEngine(const char* name, chip8::Engine& engine){
+    if(!strcmp(name,"table")) engine = chip8::Engine::Table;
+    else if(!strcmp(name,"switch")) engine = chip8::Engine::Switch;
+    else if(!strcmp(name,"threaded")) engine = chip8::Engine::Threaded;
+    else if(!strcmp(name,"specialized")) engine = chip8::Engine::Specialized;
+    else return false;
+    return true;
+}
+
+// What -score picked, register < 0 when it is memory
+struct Score{
+    int reg;
+    uint16_t addr;
+    uint16_t len;
+};
+
+static bool parseScore(const char* text, Score& s){
+    char* end;
+    // exactly one hex digit, strtol would take v-1 or v+f
+    if(text[0] == 'v' || text[0] == 'V'){
+        s.reg = isxdigit((unsigned char)text[1]) ? (int)strtol(text + 1, &end, 16) : -1;
+        return s.reg >= 0 && !text[2];
+    }
+    s.reg = -1;
+    s.addr = (uint16_t)strtoul(text, &end, 0);
+    s.len = 1;
+    if(*end == ':')
+        s.len = (uint16_t)strtoul(end + 1, &end, 0);
+    return !*end && s.len >= 1 && s.len <= 8 && s.addr + s.len <= 4096;
+}
+
+static double registerScore(void* ctx, const chip8& c){
+    return c.V[((const Score*)ctx)->reg];
+}
+
+static double memoryScore(void* ctx, const chip8& c){
+    const Score* s = (const Score*)ctx;
+    uint64_t value = 0;
+    for(uint16_t i=0;i<s->len;i++)
+        value = value << 8 | c.memory[s->addr + i];
+    return (double)value;
+}
+
+static double pixelScore(void*, const chip8& c){
+    int lit = 0;
+    for(int y=0;y<screen_height;y++){
+        for(uint64_t row = c.gfx[y]; row; row &= row - 1)
+            lit++;
+    }
+    return lit;
+}
+
+int main(int argc, char* argv[]){
+    if(argc < 2){
+        usage(argv[0]);
+        return 1;
+    }
+
+    const char* fileName = argv[1];
+    SearchOptions options;
+    uint32_t seed = 0;
+    chip8::Variant variant = chip8::Variant::Modern;
+    Score target = {-1, 0, 0};
+    bool scoreGiven = false;
+    const char* outFile = nullptr;
+
+    for(int i=2;i<argc;i++){
+        if(!strcmp(argv[i],"-beam") && i+1 < argc)
+            options.beam = strtoul(argv[++i],NULL,0);
+        else if(!strcmp(argv[i],"-children") && i+1 < argc)
+            options.children = strtoul(argv[++i],NULL,0);
+        else if(!strcmp(argv[i],"-rounds") && i+1 < argc)
+            options.rounds = strtoul(argv[++i],NULL,0);
+        else if(!strcmp(argv[i],"-frames") && i+1 < argc)
+            options.frames = strtoul(argv[++i],NULL,0);
+        else if(!strcmp(argv[i],"-hold") && i+1 < argc)
+            options.hold = strtoul(argv[++i],NULL,0);
+        else if(!strcmp(argv[i],"-ipf") && i+1 < argc)
+            options.instructionsPerFrame = strtoul(argv[++i],NULL,0);
+        else if(!strcmp(argv[i],"-keys") && i+1 < argc)
+            options.keys = (uint16_t)strtoul(argv[++i],NULL,16);
+        else if(!strcmp(argv[i],"-score") && i+1 < argc && parseScore(argv[i+1],target)){
+            scoreGiven = true;
+            i++;
+        }
+        else if(!strcmp(argv[i],"-j") && i+1 < argc)
+            options.threads = atoi(argv[++i]);
+        else if(!strcmp(argv[i],"-e") && i+1 < argc && parseEngine(argv[i+1],options.engine))
+            i++;
+        else if(!strcmp(argv[i],"-seed") && i+1 < argc)
+            seed = strtoul(argv[++i],NULL,0);
+        else if(!strcmp(argv[i],"-variant") && i+1 < argc && chip8_parseVariant(argv[i+1],variant))
+            i++;
+        else if(!strcmp(argv[i],"-o") && i+1 < argc)
+            outFile = argv[++i];
+        else{
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if(!options.instructionsPerFrame){
+        usage(argv[0]);
+        return 1;
+    }
+
+    RomFile rom;
+    std::string error;
+    if(!rom.open(fileName, error)){
+        std::cerr << error << std::endl;
+        return 1;
+    }
+
+    chip8 root;
+    root.loadProgram(rom.data(), rom.size());
+    root.timerPeriod = options.instructionsPerFrame;
+    root.seed(seed);
+    root.variant = variant;
+    // the search seed only picks the input, the game's random numbers stay those of -seed
+    options.seed = seed;
+
+    SearchScore score = pixelScore;
+    if(scoreGiven)
+        score = target.reg >= 0 ? registerScore : memoryScore;
+    SearchResult result = search(root, options, score, &target);
+
+    // play the answer back on the root, which is what a replay will do
+    std::vector<InputEvent> input = searchInput(result.frames, root.cycles, options.instructionsPerFrame);
+    const uint64_t cycles = root.cycles + (uint64_t)result.frames.size() * options.instructionsPerFrame;
+    runInput(root, input, cycles, [&](uint64_t n){ root.run(n, options.engine); });
+
+    std::cout << "score " << result.score << " after " << result.frames.size() << " frames, "
+              << input.size() << " key changes, state " << std::hex << std::setw(16) << std::setfill('0')
+              << root.hashState() << std::dec << std::endl;
+    if(score(&target, root) != result.score)
+        std::cerr << "replaying the input scored " << score(&target, root) << std::endl;
+
+    if(outFile){
+        InputLog log;
+        log.romHash = romHash(rom.data(), rom.size());
+        log.seed = seed;
+        log.timerPeriod = options.instructionsPerFrame;
+        log.variant = variant;
+        log.cycles = cycles;
+        log.events = input;
+        if(!saveInputLog(outFile, log)){
+            std::cerr << "can not write " << outFile << std::endl;
+            return 1;
+        }
+    }
+
+    std::cerr << result.forks << " forks in " << result.seconds << " s ("
+              << (result.seconds > 0 ? result.forks / result.seconds : 0) << " forks/s)" << std::endl;
+    return 0;
+}
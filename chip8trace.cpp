@@ -0,0 +1,151 @@
+// Trace analyzer, answers questions about a trace written by headless -trace
+// (see trace.h) without running anything again
+//
+// usage: chip8trace <trace> [-reg V0-VF|I|SP] [-writes addr] [-pc addr] [-dump] [-from cycle] [-to cycle]
+// With no query it prints how many records the trace holds and how big they are
+// -reg r       every instruction that changed r, e.g. where VF got set
+// -writes addr every instruction that wrote memory[addr]
+// -pc addr     every time the instruction at addr ran
+// -dump        every record
+// -from/-to    only records in [from, to] by cycle
+// Each line is the cycle, pc, opcode, handler and what the instruction changed
+#include <iostream>
+#include <cctype>
+#include <iomanip>
+#include <string>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include "chip8.h"
+#include "trace.h"
+
+static void usage(const char* name){
+    std::cerr << "usage: " << name << " <trace> [-reg V0-VF|I|SP] [-writes addr] [-pc addr] [-dump] [-from cycle] [-to cycle]" << std::endl;
+}
+
+// 0-15 for V0-VF, 16 for I, 17 for SP
+static bool parseRegister(const char* name, int& reg){
+    std::string r(name);
+    for(char& ch : r)
+        ch = (char)toupper((unsigned char)ch);
+    if(r == "I")
+        reg = 16;
+    else if(r == "SP")
+        reg = 17;
+    else if(r.size() == 2 && r[0] == 'V' && isxdigit((unsigned char)r[1]))
+        reg = (int)strtoul(r.c_str() + 1, NULL, 16);
+    else
+        return false;
+    return true;
+}
+
+static std::string hex(unsigned v, int digits){
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%0*X", digits, v);
+    return buf;
+}
+
+static void print(const TraceRecord& r){
+    std::cout << std::setw(12) << r.cycle << "  " << hex(r.pc, 3) << "  " << hex(r.opcode, 4) << "  "
+              << std::left << std::setw(6) << chip8_opnames[chip8::opId(r.opcode)] << std::right;
+    if(r.gap)
+        std::cout << " (" << r.gap << " untraced before)";
+    for(int reg=0;reg<16;reg++){
+        if(r.vChanged & (1 << reg))
+            std::cout << " V" << hex(reg, 1) << " " << hex(r.oldV[reg], 2) << "->" << hex(r.V[reg], 2);
+    }
+    if(r.I != r.oldI)
+        std::cout << " I " << hex(r.oldI, 3) << "->" << hex(r.I, 3);
+    if(r.sp != r.oldSp)
+        std::cout << " SP " << r.oldSp << "->" << r.sp;
+    for(const TraceRecord::Write& w : r.writes){
+        std::cout << " [" << hex(w.addr, 3) << "]=";
+        for(uint16_t k=0;k<w.len;k++)
+            std::cout << (k ? " " : "") << hex(w.bytes[k], 2);
+    }
+    std::cout << std::endl;
+}
+
+int main(int argc, char* argv[]){
+    if(argc < 2){
+        usage(argv[0]);
+        return 1;
+    }
+
+    const char* fileName = argv[1];
+    int reg = -1;
+    long writes = -1;
+    long pc = -1;
+    bool dump = false;
+    uint64_t from = 0, to = UINT64_MAX;
+
+    for(int i=2;i<argc;i++){
+        if(!strcmp(argv[i],"-reg") && i+1 < argc && parseRegister(argv[i+1], reg))
+            i++;
+        else if(!strcmp(argv[i],"-writes") && i+1 < argc)
+            writes = strtol(argv[++i],NULL,0) & 0xFFF;
+        else if(!strcmp(argv[i],"-pc") && i+1 < argc)
+            pc = strtol(argv[++i],NULL,0) & 0xFFF;
+        else if(!strcmp(argv[i],"-dump"))
+            dump = true;
+        else if(!strcmp(argv[i],"-from") && i+1 < argc)
+            from = strtoull(argv[++i],NULL,0);
+        else if(!strcmp(argv[i],"-to") && i+1 < argc)
+            to = strtoull(argv[++i],NULL,0);
+        else{
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    const bool query = dump || reg >= 0 || writes >= 0 || pc >= 0;
+
+    TraceReader trace;
+    std::string error;
+    if(!trace.open(fileName, error)){
+        std::cerr << error << std::endl;
+        return 1;
+    }
+
+    TraceRecord r;
+    uint64_t records = 0, matches = 0, first = 0, last = 0;
+    while(trace.next(r)){
+        if(!records++)
+            first = r.cycle;
+        last = r.cycle;
+        if(!query || r.cycle < from)
+            continue;
+        if(r.cycle > to)
+            break;
+
+        bool match = dump || (pc >= 0 && r.pc == pc);
+        if(reg >= 0 && reg < 16)
+            match |= (r.vChanged >> reg) & 1;
+        else if(reg == 16)
+            match |= r.I != r.oldI;
+        else if(reg == 17)
+            match |= r.sp != r.oldSp;
+        for(const TraceRecord::Write& w : r.writes){
+            // a write can run off the end of memory and wrap
+            if(writes >= 0 && ((writes - w.addr) & 0xFFF) < w.len)
+                match = true;
+        }
+        if(match){
+            print(r);
+            matches++;
+        }
+    }
+    if(trace.truncated)
+        std::cerr << "warning: " << fileName << " ends in the middle of a record" << std::endl;
+
+    if(!query){
+        std::cout << "variant: " << chip8_variantnames[(int)trace.variant] << std::endl;
+        std::cout << "records: " << records << std::endl;
+        if(records)
+            std::cout << "cycles:  " << first << " to " << last << std::endl;
+        std::cout << "bytes:   " << trace.fileSize() << " (" << std::fixed << std::setprecision(2)
+                  << (records ? (double)trace.fileSize() / records : 0) << " per record)" << std::endl;
+    }
+    else if(!matches)
+        std::cerr << "no matching records" << std::endl;
+    return 0;
+}
@@ -0,0 +1,105 @@
+#include "debugger.h"
+#include <cstring>
+
+Debugger::Debugger()
+    : engine(CHIP8_DEFAULT_ENGINE), watchHit(0), c(nullptr), chainedHook(nullptr), chainedCtx(nullptr),
+      breakCount(0), watchCount(0), hit(false), breakCycle(UINT64_MAX){
+    memset(breaks, 0, sizeof(breaks));
+    memset(watches, 0, sizeof(watches));
+}
+
+Debugger::~Debugger(){
+    detach();
+}
+
+void Debugger::attach(chip8& target){
+    detach();
+    c = &target;
+    chainedHook = c->writeHook;
+    chainedCtx = c->writeHookCtx;
+    c->writeHook = &Debugger::onWrite;
+    c->writeHookCtx = this;
+    breakCycle = UINT64_MAX;
+}
+
+void Debugger::detach(){
+    if(c && c->writeHookCtx == this){
+        c->writeHook = chainedHook;
+        c->writeHookCtx = chainedCtx;
+    }
+    c = nullptr;
+}
+
+void Debugger::mark(uint64_t* bits, int& count, uint16_t addr, bool on){
+    uint64_t& word = bits[(addr & 0xFFF) >> 6];
+    const uint64_t bit = 1ull << (addr & 63);
+    if(on && !(word & bit)){
+        word |= bit;
+        count++;
+    }
+    else if(!on && (word & bit)){
+        word &= ~bit;
+        count--;
+    }
+}
+
+void Debugger::setBreakpoint(uint16_t addr, bool on){
+    mark(breaks, breakCount, addr, on);
+}
+
+void Debugger::setWatchpoint(uint16_t addr, uint16_t len, bool on){
+    for(uint16_t i=0;i<len && i<4096;i++)
+        mark(watches, watchCount, addr + i, on);
+}
+
+void Debugger::clear(){
+    memset(breaks, 0, sizeof(breaks));
+    memset(watches, 0, sizeof(watches));
+    breakCount = watchCount = 0;
+}
+
+void Debugger::onWrite(void* ctx, uint16_t addr, uint16_t len){
+    Debugger* d = (Debugger*)ctx;
+    if(d->watchCount){
+        for(uint16_t i=0;i<len;i++){
+            if(d->watched(addr + i)){
+                d->hit = true;
+                d->watchHit = (addr + i) & 0xFFF;
+                break;
+            }
+        }
+    }
+    if(d->chainedHook)
+        d->chainedHook(d->chainedCtx, addr, len);
+}
+
+Debugger::Stop Debugger::run(uint64_t n){
+    if(!breakCount && !watchCount){
+        c->run(n, engine);
+        return Stop::None;
+    }
+    // anything written since the last stop (a debugger poking memory) does not count
+    hit = false;
+    for(uint64_t i=0;i<n;i++){
+        if(breakpoint(c->pc) && c->cycles != breakCycle){
+            breakCycle = c->cycles;
+            return Stop::Breakpoint;
+        }
+        c->emulateCycle();
+        if(hit){
+            hit = false;
+            return Stop::Watchpoint;
+        }
+    }
+    return Stop::None;
+}
+
+Debugger::Stop Debugger::step(){
+    hit = false;
+    c->emulateCycle();
+    if(hit){
+        hit = false;
+        return Stop::Watchpoint;
+    }
+    return Stop::Step;
+}
@@ -0,0 +1,67 @@
+#ifndef CHIP8_DEBUGGER_H
+#define CHIP8_DEBUGGER_H
+
+// Breakpoints, write watchpoints and single stepping for one instance
+//
+// The core knows nothing about any of this, the debugger drives the
+// instance itself: with nothing set run() goes straight to chip8::run() on
+// the usual engine, otherwise it steps emulateCycle() and looks pc up in a
+// 4096 bit map before each instruction. Watchpoints see memory writes
+// (op_Fx33, op_Fx55) through writeHook, chained to whatever was installed.
+// The tools only build it in with -DCHIP8_DEBUG, see gdbstub.h
+#include <cstdint>
+#include "chip8.h"
+
+class Debugger{
+public:
+    // Why run() came back early
+    enum class Stop { None, Step, Breakpoint, Watchpoint };
+
+    Debugger();
+    ~Debugger();
+
+    Debugger(const Debugger&) = delete;
+    Debugger& operator=(const Debugger&) = delete;
+
+    void attach(chip8& c);
+    void detach();
+    chip8* target() const{ return c; }
+
+    // Stop before running the instruction at addr
+    void setBreakpoint(uint16_t addr, bool on);
+    // Stop after an instruction writes any byte of [addr, addr+len)
+    void setWatchpoint(uint16_t addr, uint16_t len, bool on);
+    void clear();
+
+    bool breakpoint(uint16_t addr) const{ return (breaks[(addr & 0xFFF) >> 6] >> (addr & 63)) & 1; }
+    bool watched(uint16_t addr) const{ return (watches[(addr & 0xFFF) >> 6] >> (addr & 63)) & 1; }
+
+    // Runs up to n instructions, None when all of them ran. A breakpoint at
+    // the pc run() stopped at last time does not stop it again right away
+    Stop run(uint64_t n);
+    // Runs one instruction whatever breakpoint is on it
+    Stop step();
+
+    // engine used while no breakpoint or watchpoint is set
+    chip8::Engine engine;
+    // the watched byte written when run() returned Watchpoint
+    uint16_t watchHit;
+
+private:
+    static void onWrite(void* ctx, uint16_t addr, uint16_t len);
+    void mark(uint64_t* bits, int& count, uint16_t addr, bool on);
+
+    chip8* c;
+    chip8::WriteHook chainedHook;
+    void* chainedCtx;
+
+    uint64_t breaks[4096 / 64];
+    uint64_t watches[4096 / 64];
+    int breakCount;
+    int watchCount;
+    bool hit;
+    // cycles when run() last stopped on a breakpoint, that one is let through
+    uint64_t breakCycle;
+};
+
+#endif
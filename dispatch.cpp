@@ -0,0 +1,212 @@
+// Switch and threaded engines, see chip8::Engine
+#include "chip8.h"
+
+template<class Q>
+uint64_t chip8::runFused(const Instr& in, uint64_t budget){
+    const uint16_t addr = pc;
+    uint64_t count = 2;
+
+    if(isIdle(in.fuse))
+        return skipIdle(in, budget);
+    ++fusions[in.fuse];
+
+    switch(in.fuse){
+        case FUSE_6_D:
+            pc = addr + 4;
+            op_6(in);
+            op_D<Q>(makeInstr(in.next[0]));
+            break;
+        case FUSE_7_SKIP_1: {
+            op_7(in);
+            const Instr skip = makeInstr(in.next[0]);
+            pc = addr + 4;
+            if(skip.id == OP_3)
+                op_3(skip);
+            else
+                op_4(skip);
+            // taken skip steps over the jump
+            if(pc == addr + 4){
+                pc = addr + 6;
+                op_1(makeInstr(in.next[1]));
+                count = 3;
+            }
+            break;
+        }
+        case FUSE_Fx1E_Fx65:
+            pc = addr + 4;
+            op_Fx1E(in);
+            op_Fx65<Q>(makeInstr(in.next[0]));
+            break;
+        case FUSE_Fx1E_Fx55:
+            pc = addr + 4;
+            op_Fx1E(in);
+            op_Fx55<Q>(makeInstr(in.next[0]));
+            break;
+        case FUSE_Fx65_Fx1E:
+            pc = addr + 4;
+            op_Fx65<Q>(in);
+            op_Fx1E(makeInstr(in.next[0]));
+            break;
+        case FUSE_Fx55_Fx1E:
+            pc = addr + 2;
+            op_Fx55<Q>(in);
+            // the store may have written over the Fx1E, it runs on its own then
+            if(((memory[(addr + 2) & 0xFFF] << 8u) | memory[(addr + 3) & 0xFFF]) != in.next[0]){
+                count = 1;
+                break;
+            }
+            pc = addr + 4;
+            op_Fx1E(makeInstr(in.next[0]));
+            break;
+        default:
+            break;
+    }
+    opcode = count == 1 ? in.opcode : in.next[count - 2];
+    retire(count);
+    return count;
+}
+
+uint64_t chip8::skipIdle(const Instr& in, uint64_t budget){
+    const uint16_t addr = pc;
+    uint64_t count = budget;
+    opcode = in.opcode;
+    ++fusions[in.fuse];
+
+    switch(in.fuse){
+        case FUSE_IDLE_JUMP:
+            // jumping to itself until the budget runs out
+            break;
+        case FUSE_IDLE_KEY: {
+            // keys only change between run() calls, if none is down now the
+            // Fx0A keeps putting pc back for the rest of the budget. Any
+            // nonzero byte is a key down, as op_Fx0A reads them
+            uint64_t down[2];
+            static_assert(sizeof(down) == sizeof(keypad), "keypad is 16 bytes");
+            memcpy(down, keypad, sizeof(down));
+            if(down[0] | down[1]){
+                pc = addr + 2;
+                op_Fx0A(in);
+                count = 1;
+            }
+            break;
+        }
+        case FUSE_IDLE_POLL: {
+            if(delayTimer == 0){
+                pc = addr + 2;
+                op_Fx07(in);
+                count = 1;
+                break;
+            }
+            // pass k reads the timer after 3k instructions and still sees it
+            // non zero while timerPhase + 3k < delayTimer * timerPeriod
+            uint64_t passes = ((uint64_t)delayTimer * timerPeriod - timerPhase + 2) / 3;
+            if(passes > budget / 3)
+                passes = budget / 3;
+            // what the last skipped Fx07 read
+            V[in.x] = delayTimer - (timerPhase + (passes - 1) * 3) / timerPeriod;
+            opcode = in.next[1];
+            count = passes * 3;
+            break;
+        }
+        default:
+            break;
+    }
+    if(count > 1)
+        idleCycles += count;
+    retire(count);
+    return count;
+}
+
+template<class Q>
+void chip8::runSwitch(uint64_t n){
+    for(uint64_t i=0;i<n;){
+        const Instr& in = fetch();
+        if(in.fuse != FUSE_NONE && n - i >= fuseLength(in.fuse)){
+            i += runFused<Q>(in, n - i);
+            continue;
+        }
+        opcode = in.opcode;
+        pc += 2;
+        exec<Q>(in);
+        retire();
+        i++;
+    }
+}
+
+template<class Q>
+void chip8::runThreaded(uint64_t n){
+#if defined(__GNUC__)
+    // one label per OpId, every handler jumps straight to the next one
+    // instead of returning to a shared dispatch point
+    static void* const labels[OP_COUNT] = {
+        &&l_NULL, &&l_00E0, &&l_00EE, &&l_1, &&l_2, &&l_3, &&l_4, &&l_5, &&l_6, &&l_7,
+        &&l_8xy0, &&l_8xy1, &&l_8xy2, &&l_8xy3, &&l_8xy4, &&l_8xy5, &&l_8xy6, &&l_8xy7, &&l_8xyE,
+        &&l_9, &&l_A, &&l_B, &&l_C, &&l_D, &&l_Ex9E, &&l_ExA1,
+        &&l_Fx07, &&l_Fx0A, &&l_Fx15, &&l_Fx18, &&l_Fx1E, &&l_Fx29, &&l_Fx33, &&l_Fx55, &&l_Fx65
+    };
+    const Instr* in;
+
+    if(n == 0)
+        return;
+
+#define DISPATCH() in = &fetch(); \
+    if(in->fuse != FUSE_NONE && n >= fuseLength(in->fuse)) goto l_fused; \
+    opcode = in->opcode; pc += 2; goto *labels[in->id]
+#define NEXT() retire(); if(--n == 0) return; DISPATCH()
+
+    DISPATCH();
+
+l_fused: n -= runFused<Q>(*in, n); if(n == 0) return; DISPATCH();
+l_NULL: NEXT();
+l_00E0: op_00E0(*in); NEXT();
+l_00EE: op_00EE(*in); NEXT();
+l_1: op_1(*in); NEXT();
+l_2: op_2(*in); NEXT();
+l_3: op_3(*in); NEXT();
+l_4: op_4(*in); NEXT();
+l_5: op_5(*in); NEXT();
+l_6: op_6(*in); NEXT();
+l_7: op_7(*in); NEXT();
+l_8xy0: op_8xy0(*in); NEXT();
+l_8xy1: op_8xy1(*in); NEXT();
+l_8xy2: op_8xy2(*in); NEXT();
+l_8xy3: op_8xy3(*in); NEXT();
+l_8xy4: op_8xy4(*in); NEXT();
+l_8xy5: op_8xy5(*in); NEXT();
+l_8xy6: op_8xy6<Q>(*in); NEXT();
+l_8xy7: op_8xy7(*in); NEXT();
+l_8xyE: op_8xyE<Q>(*in); NEXT();
+l_9: op_9(*in); NEXT();
+l_A: op_A(*in); NEXT();
+l_B: op_B<Q>(*in); NEXT();
+l_C: op_C(*in); NEXT();
+l_D: op_D<Q>(*in); NEXT();
+l_Ex9E: op_Ex9E(*in); NEXT();
+l_ExA1: op_ExA1(*in); NEXT();
+l_Fx07: op_Fx07(*in); NEXT();
+l_Fx0A: op_Fx0A(*in); NEXT();
+l_Fx15: op_Fx15(*in); NEXT();
+l_Fx18: op_Fx18(*in); NEXT();
+l_Fx1E: op_Fx1E(*in); NEXT();
+l_Fx29: op_Fx29(*in); NEXT();
+l_Fx33: op_Fx33(*in); NEXT();
+l_Fx55: op_Fx55<Q>(*in); NEXT();
+l_Fx65: op_Fx65<Q>(*in); NEXT();
+
+#undef NEXT
+#undef DISPATCH
+#else
+    // no computed goto outside GCC/Clang
+    runSwitch<Q>(n);
+#endif
+}
+
+// every variant chip8::run() can pick
+#define CHIP8_ENGINES(Q) \
+    template void chip8::runSwitch<Q>(uint64_t n); \
+    template void chip8::runThreaded<Q>(uint64_t n);
+CHIP8_ENGINES(chip8::ModernQuirks)
+CHIP8_ENGINES(chip8::CosmacQuirks)
+CHIP8_ENGINES(chip8::SuperChipQuirks)
+CHIP8_ENGINES(chip8::XoChipQuirks)
+#undef CHIP8_ENGINES
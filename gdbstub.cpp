@@ -0,0 +1,463 @@
+#include "gdbstub.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+const int SIGINT_ = 2;
+const int SIGTRAP_ = 5;
+
+// register number to size in bytes, V0-VF, I, PC, SP, DT, ST
+const int REG_COUNT = 21;
+int regSize(int reg){
+    return reg == 16 || reg == 17 ? 2 : 1;
+}
+
+const char targetXml[] =
+    "<?xml version=\"1.0\"?>"
+    "<!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+    "<target version=\"1.0\"><feature name=\"org.chip8.core\">"
+    "<reg name=\"v0\" bitsize=\"8\" regnum=\"0\"/><reg name=\"v1\" bitsize=\"8\"/>"
+    "<reg name=\"v2\" bitsize=\"8\"/><reg name=\"v3\" bitsize=\"8\"/>"
+    "<reg name=\"v4\" bitsize=\"8\"/><reg name=\"v5\" bitsize=\"8\"/>"
+    "<reg name=\"v6\" bitsize=\"8\"/><reg name=\"v7\" bitsize=\"8\"/>"
+    "<reg name=\"v8\" bitsize=\"8\"/><reg name=\"v9\" bitsize=\"8\"/>"
+    "<reg name=\"va\" bitsize=\"8\"/><reg name=\"vb\" bitsize=\"8\"/>"
+    "<reg name=\"vc\" bitsize=\"8\"/><reg name=\"vd\" bitsize=\"8\"/>"
+    "<reg name=\"ve\" bitsize=\"8\"/><reg name=\"vf\" bitsize=\"8\"/>"
+    "<reg name=\"i\" bitsize=\"16\" type=\"data_ptr\"/>"
+    "<reg name=\"pc\" bitsize=\"16\" type=\"code_ptr\"/>"
+    "<reg name=\"sp\" bitsize=\"8\"/><reg name=\"dt\" bitsize=\"8\"/><reg name=\"st\" bitsize=\"8\"/>"
+    "</feature></target>";
+
+std::string hex(unsigned v, int digits){
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%0*x", digits, v);
+    return buf;
+}
+
+int hexDigit(char ch){
+    if(ch >= '0' && ch <= '9') return ch - '0';
+    if(ch >= 'a' && ch <= 'f') return ch - 'a' + 10;
+    if(ch >= 'A' && ch <= 'F') return ch - 'A' + 10;
+    return -1;
+}
+
+// Reads a hex number from s at pos, up to the first non hex character.
+// Nothing in the 4K machine needs more than 16 bits, anything bigger fails
+// so the callers' bounds checks never see a value that wraps
+bool parseHex(const std::string& s, size_t& pos, unsigned long& v){
+    size_t start = pos;
+    v = 0;
+    while(pos < s.size() && hexDigit(s[pos]) >= 0){
+        v = (v << 4) | hexDigit(s[pos++]);
+        if(v > 0xFFFF)
+            return false;
+    }
+    return pos > start;
+}
+
+bool parseByte(const std::string& s, size_t& pos, uint8_t& b){
+    if(pos + 2 > s.size() || hexDigit(s[pos]) < 0 || hexDigit(s[pos + 1]) < 0)
+        return false;
+    b = (uint8_t)(hexDigit(s[pos]) << 4 | hexDigit(s[pos + 1]));
+    pos += 2;
+    return true;
+}
+
+#ifndef _WIN32
+
+int openServer(uint16_t port, std::string& error){
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(fd < 0){
+        error = "could not create a socket";
+        return -1;
+    }
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(bind(fd, (sockaddr*)&addr, sizeof(addr)) || ::listen(fd, 1)){
+        close(fd);
+        error = "could not listen on port " + std::to_string(port);
+        return -1;
+    }
+    return fd;
+}
+
+int acceptClient(int server){
+    int fd = ::accept(server, nullptr, nullptr);
+    if(fd >= 0){
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+    return fd;
+}
+
+bool waitReadable(int fd, int timeoutMs){
+    fd_set set;
+    FD_ZERO(&set);
+    FD_SET(fd, &set);
+    timeval tv{timeoutMs / 1000, (timeoutMs % 1000) * 1000};
+    return select(fd + 1, &set, nullptr, nullptr, timeoutMs < 0 ? nullptr : &tv) > 0;
+}
+
+long readSome(int fd, char* buf, size_t size){
+    return ::recv(fd, buf, size, 0);
+}
+
+bool writeAll(int fd, const std::string& s){
+#ifdef MSG_NOSIGNAL
+    const int flags = MSG_NOSIGNAL; // a client gone away is not worth a SIGPIPE
+#else
+    const int flags = 0;
+#endif
+    for(size_t done=0;done<s.size();){
+        long n = ::send(fd, s.data() + done, s.size() - done, flags);
+        if(n <= 0)
+            return false;
+        done += n;
+    }
+    return true;
+}
+
+void closeSocket(int fd){
+    close(fd);
+}
+
+#else
+
+int openServer(uint16_t, std::string& error){
+    error = "the gdb stub needs POSIX sockets";
+    return -1;
+}
+int acceptClient(int){ return -1; }
+bool waitReadable(int, int){ return false; }
+long readSome(int, char*, size_t){ return 0; }
+bool writeAll(int, const std::string&){ return false; }
+void closeSocket(int){}
+
+#endif
+
+}
+
+GdbStub::GdbStub(Debugger& debugger)
+    : debugger(debugger), server(-1), client(-1), halted(false), stepping(false),
+      lastStop(Debugger::Stop::None), lastSignal(SIGTRAP_){
+}
+
+GdbStub::~GdbStub(){
+    hangUp();
+    if(server >= 0)
+        closeSocket(server);
+}
+
+bool GdbStub::listen(uint16_t port, std::string& error){
+    server = openServer(port, error);
+    return server >= 0;
+}
+
+void GdbStub::poll(int timeoutMs){
+    if(client < 0){
+        if(server >= 0 && waitReadable(server, timeoutMs))
+            accept();
+        return;
+    }
+    if(waitReadable(client, timeoutMs))
+        receive();
+}
+
+void GdbStub::accept(){
+    client = acceptClient(server);
+    if(client < 0)
+        return;
+    // a new client finds the instance stopped wherever it was
+    halted = true;
+    stepping = false;
+    lastStop = Debugger::Stop::None;
+    lastSignal = SIGTRAP_;
+    input.clear();
+}
+
+void GdbStub::hangUp(){
+    if(client >= 0)
+        closeSocket(client);
+    client = -1;
+    // nobody left to report a stop to
+    debugger.clear();
+    halted = false;
+    stepping = false;
+    input.clear();
+}
+
+void GdbStub::run(uint64_t n){
+    if(client < 0){
+        debugger.run(n);
+        return;
+    }
+    if(halted)
+        return;
+    Debugger::Stop stop = stepping ? debugger.step() : debugger.run(n);
+    if(stop != Debugger::Stop::None){
+        lastStop = stop;
+        halted = true;
+        stepping = false;
+        reportStop(SIGTRAP_);
+    }
+}
+
+void GdbStub::exited(int code){
+    if(client < 0)
+        return;
+    send("W" + hex(code & 0xFF, 2));
+    hangUp();
+}
+
+void GdbStub::reportStop(int signal){
+    lastSignal = signal;
+    if(lastStop == Debugger::Stop::Watchpoint)
+        send("T" + hex(signal, 2) + "watch:" + hex(debugger.watchHit, 4) + ";");
+    else
+        send("S" + hex(signal, 2));
+}
+
+void GdbStub::send(const std::string& payload){
+    uint8_t sum = 0;
+    for(char ch : payload)
+        sum += (uint8_t)ch;
+    if(client >= 0 && !writeAll(client, "$" + payload + "#" + hex(sum, 2)))
+        hangUp();
+}
+
+void GdbStub::receive(){
+    char buf[4096];
+    long n = readSome(client, buf, sizeof(buf));
+    if(n <= 0){
+        hangUp();
+        return;
+    }
+    input.append(buf, n);
+
+    size_t i = 0;
+    while(i < input.size() && client >= 0){
+        if(input[i] == '$'){
+            size_t end = input.find('#', i);
+            if(end == std::string::npos || end + 2 >= input.size())
+                break; // the rest has not arrived yet
+            std::string packet = input.substr(i + 1, end - i - 1);
+            uint8_t sum = 0, expected;
+            for(char ch : packet)
+                sum += (uint8_t)ch;
+            size_t at = end + 1;
+            bool good = parseByte(input, at, expected) && expected == sum;
+            i = end + 3;
+            if(!writeAll(client, good ? "+" : "-")){
+                hangUp();
+                break;
+            }
+            if(good)
+                handle(packet);
+            continue;
+        }
+        // Ctrl-C, acks and anything else outside a packet
+        if(input[i] == 0x03 && !halted){
+            halted = true;
+            stepping = false;
+            lastStop = Debugger::Stop::None;
+            reportStop(SIGINT_);
+        }
+        i++;
+    }
+    if(client >= 0)
+        input.erase(0, i);
+}
+
+std::string GdbStub::readRegisters() const{
+    const chip8& c = *debugger.target();
+    std::string out;
+    for(int reg=0;reg<16;reg++)
+        out += hex(c.V[reg], 2);
+    out += hex(c.I & 0xFF, 2) + hex(c.I >> 8, 2);
+    out += hex(c.pc & 0xFF, 2) + hex(c.pc >> 8, 2);
+    out += hex(c.sp & 0xFF, 2) + hex(c.delayTimer, 2) + hex(c.soundTimer, 2);
+    return out;
+}
+
+bool GdbStub::writeRegister(int reg, const std::string& s, size_t& pos){
+    chip8& c = *debugger.target();
+    uint8_t lo, hi = 0;
+    if(!parseByte(s, pos, lo) || (regSize(reg) == 2 && !parseByte(s, pos, hi)))
+        return false;
+    const uint16_t v = lo | (hi << 8);
+    if(reg < 16)
+        c.V[reg] = lo;
+    else if(reg == 16)
+        c.I = v & 0xFFF;
+    else if(reg == 17)
+        c.pc = v & 0xFFF;
+    else if(reg == 18 && lo <= 16)
+        c.sp = lo;
+    else if(reg == 19)
+        c.delayTimer = lo;
+    else if(reg == 20)
+        c.soundTimer = lo;
+    else
+        return false;
+    return true;
+}
+
+void GdbStub::handle(const std::string& packet){
+    chip8& c = *debugger.target();
+    const char cmd = packet.empty() ? 0 : packet[0];
+    size_t pos = 1;
+    unsigned long addr, len, value;
+
+    switch(cmd){
+        case '?':
+            reportStop(lastSignal);
+            return;
+        case 'g':
+            send(readRegisters());
+            return;
+        case 'G':{
+            bool ok = true;
+            for(int reg=0;reg<REG_COUNT && ok;reg++)
+                ok = writeRegister(reg, packet, pos);
+            send(ok ? "OK" : "E01");
+            return;
+        }
+        case 'p':{
+            if(!parseHex(packet, pos, value) || value >= REG_COUNT){
+                send("E01");
+                return;
+            }
+            std::string regs = readRegisters();
+            size_t offset = 0;
+            for(unsigned long reg=0;reg<value;reg++)
+                offset += 2 * regSize(reg);
+            send(regs.substr(offset, 2 * regSize(value)));
+            return;
+        }
+        case 'P':{
+            bool ok = parseHex(packet, pos, value) && pos < packet.size() && packet[pos] == '=';
+            pos++;
+            send(ok && value < REG_COUNT && writeRegister(value, packet, pos) ? "OK" : "E01");
+            return;
+        }
+        case 'm':{
+            if(!parseHex(packet, pos, addr) || packet[pos++] != ',' || !parseHex(packet, pos, len) || addr > 0xFFF){
+                send("E01");
+                return;
+            }
+            std::string out;
+            for(unsigned long i=0;i<len && addr + i <= 0xFFF;i++)
+                out += hex(c.memory[addr + i], 2);
+            send(out);
+            return;
+        }
+        case 'M':{
+            if(!parseHex(packet, pos, addr) || packet[pos++] != ',' || !parseHex(packet, pos, len) ||
+               packet[pos++] != ':' || addr > 0xFFF || len > 0x1000 - addr){
+                send("E01");
+                return;
+            }
+            // all of it parses or none of it is written
+            uint8_t bytes[0x1000];
+            for(unsigned long i=0;i<len;i++){
+                if(!parseByte(packet, pos, bytes[i])){
+                    send("E01");
+                    return;
+                }
+            }
+            // stale decode slots and compiled code go, like after op_Fx55
+            if(len){
+                memcpy(c.memory + addr, bytes, len);
+                c.invalidate((uint16_t)addr, (uint16_t)len);
+            }
+            send("OK");
+            return;
+        }
+        case 'c':
+        case 's':
+            // the reply is the stop packet once it stops again
+            if(parseHex(packet, pos, addr))
+                c.pc = addr & 0xFFF;
+            halted = false;
+            stepping = cmd == 's';
+            return;
+        case 'Z':
+        case 'z':{
+            const bool on = cmd == 'Z';
+            const char type = packet.size() > 1 ? packet[1] : 0;
+            pos = 2;
+            if(packet.size() < 3 || packet[pos++] != ',' || !parseHex(packet, pos, addr) || packet[pos++] != ',' || !parseHex(packet, pos, len)){
+                send("E01");
+                return;
+            }
+            if(type == '0' || type == '1')
+                debugger.setBreakpoint((uint16_t)addr, on);
+            else if(type == '2')
+                debugger.setWatchpoint((uint16_t)addr, (uint16_t)len, on);
+            else{
+                send(""); // read and access watchpoints, nothing reads memory through a hook
+                return;
+            }
+            send("OK");
+            return;
+        }
+        case 'D':
+            send("OK");
+            hangUp();
+            return;
+        case 'k':
+            hangUp();
+            return;
+        case 'H':
+            send("OK");
+            return;
+        case 'q':
+            if(!packet.compare(0, 10, "qSupported"))
+                send("PacketSize=4000;qXfer:features:read+");
+            else if(!packet.compare(0, 31, "qXfer:features:read:target.xml:")){
+                pos = 31;
+                if(!parseHex(packet, pos, addr) || packet[pos++] != ',' || !parseHex(packet, pos, len)){
+                    send("E01");
+                    return;
+                }
+                const std::string xml(targetXml);
+                if(addr >= xml.size())
+                    send("l");
+                else{
+                    std::string part = xml.substr(addr, len);
+                    send((addr + part.size() < xml.size() ? "m" : "l") + part);
+                }
+            }
+            else if(packet == "qAttached")
+                send("1");
+            else if(packet == "qC")
+                send("QC1");
+            else if(packet == "qfThreadInfo")
+                send("m1");
+            else if(packet == "qsThreadInfo")
+                send("l");
+            else
+                send("");
+            return;
+        default:
+            // anything else is not supported, an empty reply tells the client so
+            send("");
+            return;
+    }
+}
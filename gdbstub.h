@@ -0,0 +1,65 @@
+#ifndef CHIP8_GDBSTUB_H
+#define CHIP8_GDBSTUB_H
+
+// GDB remote serial protocol server for a Debugger, on a local TCP port
+//
+// Single threaded on purpose: whoever runs the instance calls poll() to
+// answer the client and run() instead of chip8::run(), so the instance is
+// only ever touched from that thread. A client that connects finds the
+// instance stopped, like GDB expects.
+//
+// Supported: ? g G p P m M c s, Z0/Z1 (breakpoints), Z2 (write watchpoints),
+// D, k, Ctrl-C and qSupported/qXfer target.xml for the register layout:
+// V0-VF (8 bits), I, PC (16), SP, DT, ST (8), little endian.
+// Memory is the 4K address space, anything past 0xFFF is an error.
+// POSIX sockets only, listen() fails elsewhere.
+#include <cstdint>
+#include <string>
+#include "debugger.h"
+
+class GdbStub{
+public:
+    explicit GdbStub(Debugger& debugger);
+    ~GdbStub();
+
+    GdbStub(const GdbStub&) = delete;
+    GdbStub& operator=(const GdbStub&) = delete;
+
+    // Listens on 127.0.0.1:port, false with the reason in error
+    bool listen(uint16_t port, std::string& error);
+    // Waits up to timeoutMs (-1 for ever) for something to do: a client
+    // connecting, or packets from the one connected, which it then answers
+    void poll(int timeoutMs);
+
+    bool connected() const{ return client >= 0; }
+    // true while a client holds the instance
+    bool stopped() const{ return client >= 0 && halted; }
+
+    // Runs up to n instructions unless stopped, telling the client when a
+    // breakpoint, watchpoint or step stops it
+    void run(uint64_t n);
+    // Tells the client the program is gone and hangs up
+    void exited(int code);
+
+private:
+    void accept();
+    void hangUp();
+    void receive();
+    void handle(const std::string& packet);
+    void send(const std::string& payload);
+    void reportStop(int signal);
+
+    std::string readRegisters() const;
+    bool writeRegister(int reg, const std::string& hex, size_t& pos);
+
+    Debugger& debugger;
+    int server;
+    int client;
+    bool halted;
+    bool stepping;
+    Debugger::Stop lastStop;
+    int lastSignal;
+    std::string input;
+};
+
+#endif
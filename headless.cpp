@@ -0,0 +1,283 @@
+// Headless runner, executes a ROM as fast as the host allows without SDL
+// and reports how many instructions per second the interpreter managed
+//
+// usage: headless <rom> [-c cycles] [-f frames] [-ipf instructionsPerFrame] [-e engine] [-seed n] [-variant v] [-replay inputlog] [-profile file] [-trace file] [-gdb port]
+// -variant picks the quirks, modern (default), cosmac, schip or xochip
+// -replay runs the ROM through a recorded input log (see inputlog.h) with its
+// seed and timer period, to the cycle the recording stopped at
+// -profile file writes the per handler profile (text, or JSON for *.json) at
+// exit and whenever SIGUSR1 arrives, needs a -DCHIP8_PROFILE build
+// -trace file records every instruction and what it changed (see trace.h,
+// chip8trace reads it back), the ROM then runs one instruction at a time
+// whatever -e says
+// -gdb port waits for a GDB remote protocol client on localhost:port and
+// runs the ROM under it (see gdbstub.h), needs a -DCHIP8_DEBUG build
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <csignal>
+#include "chip8.h"
+#include "romfile.h"
+#include "jit.h"
+#include "aot.h"
+#include "inputlog.h"
+#include "trace.h"
+#ifdef CHIP8_PROFILE
+#include "profile.h"
+#endif
+#ifdef CHIP8_DEBUG
+#include "gdbstub.h"
+#endif
+
+static void usage(const char* name){
+    std::cerr << "usage: " << name << " <rom> [-c cycles] [-f frames] [-ipf instructionsPerFrame] [-e table|switch|threaded|specialized|jit|aot] [-seed n] [-variant modern|cosmac|schip|xochip] [-replay inputlog] [-profile file] [-trace file] [-gdb port]" << std::endl;
+}
+
+#ifdef CHIP8_PROFILE
+static volatile sig_atomic_t profileRequested = 0;
+
+static void requestProfile(int){
+    profileRequested = 1;
+}
+#endif
+
+static bool parseEngine(const char* name, chip8::Engine& engine, bool& jit, bool& aot){
+    jit = aot = false;
+    if(!strcmp(name,"jit")) jit = true;
+    else if(!strcmp(name,"aot")) aot = true;
+    else if(!strcmp(name,"table")) engine = chip8::Engine::Table;
+    else if(!strcmp(name,"switch")) engine = chip8::Engine::Switch;
+    else if(!strcmp(name,"threaded")) engine = chip8::Engine::Threaded;
+    else if(!strcmp(name,"specialized")) engine = chip8::Engine::Specialized;
+    else return false;
+    return true;
+}
+
+int main(int argc, char* argv[]){
+    if(argc < 2){
+        usage(argv[0]);
+        return 1;
+    }
+
+    const char* fileName = argv[1];
+    uint64_t cycleCount = 10000000;
+    uint64_t frames = 0;
+    uint64_t ipf = 10;
+    chip8::Engine engine = CHIP8_DEFAULT_ENGINE;
+    bool useJit = false;
+    bool useAot = false;
+    uint32_t seed = 0;
+    chip8::Variant variant = chip8::Variant::Modern;
+    const char* replayFile = nullptr;
+    const char* profileFile = nullptr;
+    const char* traceFile = nullptr;
+    uint16_t gdbPort = 0;
+
+    for(int i=2;i<argc;i++){
+        if(!strcmp(argv[i],"-c") && i+1 < argc)
+            cycleCount = strtoull(argv[++i],NULL,0);
+        else if(!strcmp(argv[i],"-f") && i+1 < argc)
+            frames = strtoull(argv[++i],NULL,0);
+        else if(!strcmp(argv[i],"-ipf") && i+1 < argc)
+            ipf = strtoull(argv[++i],NULL,0);
+        else if(!strcmp(argv[i],"-e") && i+1 < argc && parseEngine(argv[i+1],engine,useJit,useAot))
+            i++;
+        else if(!strcmp(argv[i],"-seed") && i+1 < argc)
+            seed = strtoul(argv[++i],NULL,0);
+        else if(!strcmp(argv[i],"-variant") && i+1 < argc && chip8_parseVariant(argv[i+1],variant))
+            i++;
+        else if(!strcmp(argv[i],"-replay") && i+1 < argc)
+            replayFile = argv[++i];
+        else if(!strcmp(argv[i],"-profile") && i+1 < argc)
+            profileFile = argv[++i];
+        else if(!strcmp(argv[i],"-trace") && i+1 < argc)
+            traceFile = argv[++i];
+        else if(!strcmp(argv[i],"-gdb") && i+1 < argc)
+            gdbPort = (uint16_t)strtoul(argv[++i],NULL,0);
+        else{
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    // frames take priority over a raw cycle count
+    if(frames)
+        cycleCount = frames * ipf;
+
+    RomFile rom;
+    std::string error;
+    if(!rom.open(fileName, error)){
+        std::cerr << error << std::endl;
+        return 1;
+    }
+
+    chip8 c;
+    c.loadProgram(rom.data(), rom.size());
+    std::unique_ptr<chip8::Code> code(new chip8::Code);
+    c.decodeAll(*code);
+    // in frame mode the timers tick once per frame like in the frontend
+    if(frames && ipf)
+        c.timerPeriod = ipf;
+    c.seed(seed);
+    c.variant = variant;
+
+    InputLog replay;
+    if(replayFile){
+        std::string error;
+        if(!loadInputLog(replayFile, replay, error)){
+            std::cerr << error << std::endl;
+            return 1;
+        }
+        if(replay.romHash != romHash(rom.data(), rom.size()))
+            std::cerr << "warning: " << replayFile << " was recorded with a different ROM" << std::endl;
+        c.timerPeriod = replay.timerPeriod ? replay.timerPeriod : 1;
+        c.seed(replay.seed);
+        c.variant = replay.variant;
+        cycleCount = replay.cycles;
+    }
+
+    Jit jit;
+    if(useJit)
+        jit.attach(c);
+
+    // aot needs the chip8aot output for this ROM linked in
+    const AotProgram* aot = useAot ? aotFind(c) : nullptr;
+    if(useAot && !aot){
+        std::cerr << "no compiled program for " << fileName << ", build it with chip8aot" << std::endl;
+        return 1;
+    }
+
+#ifdef CHIP8_PROFILE
+    Chip8Profile profile;
+    if(profileFile){
+        c.profile = &profile;
+#ifdef SIGUSR1
+        signal(SIGUSR1, requestProfile);
+#endif
+    }
+#else
+    if(profileFile){
+        std::cerr << "-profile needs a build with -DCHIP8_PROFILE" << std::endl;
+        return 1;
+    }
+#endif
+
+#ifdef CHIP8_DEBUG
+    Debugger debugger;
+    GdbStub gdb(debugger);
+    if(gdbPort){
+        if(useJit || aot || traceFile){
+            std::cerr << "-gdb runs the interpreter, it does not go with -e jit, -e aot or -trace" << std::endl;
+            return 1;
+        }
+        debugger.attach(c);
+        debugger.engine = engine;
+        if(!gdb.listen(gdbPort, error)){
+            std::cerr << error << std::endl;
+            return 1;
+        }
+        std::cerr << "waiting for gdb on port " << gdbPort << std::endl;
+        while(!gdb.connected())
+            gdb.poll(-1);
+    }
+#else
+    if(gdbPort){
+        std::cerr << "-gdb needs a build with -DCHIP8_DEBUG" << std::endl;
+        return 1;
+    }
+#endif
+
+    Tracer tracer;
+    if(traceFile && !tracer.start(traceFile, c, error)){
+        std::cerr << error << std::endl;
+        return 1;
+    }
+
+    auto run = [&](uint64_t n){
+#ifdef CHIP8_DEBUG
+        // a slice at a time so the client is answered while the ROM runs,
+        // nothing runs while it holds the instance stopped
+        if(gdbPort){
+            const uint64_t until = c.cycles + n;
+            while(c.cycles < until){
+                gdb.poll(gdb.stopped() ? 100 : 0);
+                if(!gdb.stopped())
+                    gdb.run(std::min<uint64_t>(until - c.cycles, 1 << 16));
+            }
+            return;
+        }
+#endif
+        if(traceFile){
+            tracer.run(n);
+            return;
+        }
+#ifdef CHIP8_PROFILE
+        // short slices so a SIGUSR1 is answered while the ROM runs
+        if(profileFile){
+            while(n){
+                uint64_t slice = n < (1u << 20) ? n : (1u << 20);
+                c.run(slice, engine);
+                n -= slice;
+                if(profileRequested){
+                    profileRequested = 0;
+                    writeProfile(profileFile, profile);
+                }
+            }
+            return;
+        }
+#endif
+        if(useJit)
+            jit.run(n);
+        else if(aot)
+            aotRun(*aot, c, n);
+        else
+            c.run(n, engine);
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    if(replayFile)
+        runInput(c, replay.events, cycleCount, run);
+    else
+        run(cycleCount);
+    auto end = std::chrono::steady_clock::now();
+
+#ifdef CHIP8_DEBUG
+    gdb.exited(0);
+#endif
+    if(traceFile && !tracer.finish())
+        std::cerr << "could not write " << traceFile << std::endl;
+
+#ifdef CHIP8_PROFILE
+    if(profileFile && !writeProfile(profileFile, profile))
+        std::cerr << "could not write " << profileFile << std::endl;
+#endif
+
+    double seconds = std::chrono::duration<double>(end - start).count();
+    std::cout << "cycles:  " << c.cycles << std::endl;
+    std::cout << "seconds: " << seconds << std::endl;
+    std::cout << "ips:     " << (seconds > 0 ? c.cycles / seconds : 0) << std::endl;
+    std::cout << "state:   " << std::hex << c.hashState() << std::dec << std::endl;
+    if(useJit){
+        std::cout << "jit:     " << jit.nativeInstructions << " native, " << jit.interpretedInstructions
+                  << " interpreted, " << jit.blocksCompiled << " blocks, " << jit.blocksInvalidated << " invalidated" << std::endl;
+    }
+    if(traceFile)
+        std::cout << "trace:   " << tracer.records() << " records, " << tracer.bytes() << " bytes" << std::endl;
+    if(c.idleCycles)
+        std::cout << "idle:    " << c.idleCycles << " cycles fast forwarded" << std::endl;
+    uint64_t fused = 0;
+    for(int f=1;f<chip8::FUSE_COUNT;f++)
+        fused += c.fusions[f];
+    if(fused){
+        std::cout << "fused:  ";
+        for(int f=1;f<chip8::FUSE_COUNT;f++)
+            std::cout << " " << chip8_fusenames[f] << "=" << c.fusions[f];
+        std::cout << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,181 @@
+#include "inputlog.h"
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+
+namespace {
+
+const char magic[4] = {'C', '8', 'I', 'N'};
+
+void put(std::string& out, uint64_t v, int bytes){
+    for(int i=0;i<bytes;i++)
+        out.push_back((char)(v >> (8 * i)));
+}
+
+bool get(const std::string& in, size_t& pos, uint64_t& v, int bytes){
+    if(pos + bytes > in.size())
+        return false;
+    v = 0;
+    for(int i=0;i<bytes;i++)
+        v |= (uint64_t)(uint8_t)in[pos++] << (8 * i);
+    return true;
+}
+
+void putCount(std::string& out, uint64_t n){
+    while(n >= 0x80){
+        out.push_back((char)(n | 0x80));
+        n >>= 7;
+    }
+    out.push_back((char)n);
+}
+
+bool getCount(const std::string& in, size_t& pos, uint64_t& n){
+    n = 0;
+    for(int shift=0;shift<64;shift+=7){
+        if(pos >= in.size())
+            return false;
+        uint8_t b = in[pos++];
+        n |= (uint64_t)(b & 0x7F) << shift;
+        if(!(b & 0x80))
+            return true;
+    }
+    return false;
+}
+
+}
+
+uint64_t romHash(const uint8_t* rom, size_t size){
+    uint64_t h = 1469598103934665603ull;
+    for(size_t i=0;i<size;i++){
+        h ^= rom[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+InputRecorder::InputRecorder(){
+    log = InputLog{0, 0, 1, chip8::Variant::Modern, 0, {}};
+    memset(keys, 0, sizeof(keys));
+}
+
+void InputRecorder::start(const chip8& c, const uint8_t* rom, size_t romSize, uint32_t seed){
+    log = InputLog{romHash(rom, romSize), seed, c.timerPeriod, c.variant, c.cycles, {}};
+    memset(keys, 0, sizeof(keys));
+    sample(c);
+}
+
+void InputRecorder::sample(const chip8& c){
+    for(uint8_t k=0;k<16;k++){
+        if(c.keypad[k] != keys[k]){
+            keys[k] = c.keypad[k];
+            log.events.push_back(InputEvent{c.cycles, k, (uint8_t)(keys[k] ? 1 : 0)});
+        }
+    }
+    log.cycles = c.cycles;
+}
+
+void InputRecorder::rewound(const chip8& c){
+    while(!log.events.empty() && log.events.back().cycle >= c.cycles)
+        log.events.pop_back();
+    // the keys as the events left them, the next sample() records whatever differs
+    memset(keys, 0, sizeof(keys));
+    for(const InputEvent& e : log.events)
+        keys[e.key] = e.down;
+    log.cycles = c.cycles;
+}
+
+void InputRecorder::finish(const chip8& c){
+    log.cycles = c.cycles;
+}
+
+bool saveInputLog(const char* fileName, const InputLog& log){
+    std::string out(magic, sizeof(magic));
+    put(out, CHIP8_INPUTLOG_VERSION, 4);
+    put(out, log.romHash, 8);
+    put(out, log.seed, 4);
+    put(out, log.timerPeriod, 4);
+    put(out, (uint8_t)log.variant, 1);
+    put(out, log.cycles, 8);
+    put(out, log.events.size(), 4);
+    uint64_t last = 0;
+    for(const InputEvent& e : log.events){
+        putCount(out, e.cycle - last);
+        out.push_back((char)((e.key & 0xF) | (e.down ? 0x80 : 0)));
+        last = e.cycle;
+    }
+
+    std::ofstream f(fileName, std::ios::binary);
+    f.write(out.data(), out.size());
+    return (bool)f;
+}
+
+bool loadInputLog(const char* fileName, InputLog& log, std::string& error){
+    std::ifstream f(fileName, std::ios::binary);
+    if(!f){
+        error = std::string("could not open ") + fileName;
+        return false;
+    }
+    std::string in((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+
+    size_t pos = sizeof(magic);
+    uint64_t version, hash, seed, period, variant = 0, cycles, count;
+    if(in.compare(0, sizeof(magic), magic, sizeof(magic))){
+        error = std::string(fileName) + ": not an input log";
+        return false;
+    }
+    if(!get(in, pos, version, 4) || version < 1 || version > CHIP8_INPUTLOG_VERSION){
+        error = std::string(fileName) + ": unsupported input log version";
+        return false;
+    }
+    if(!get(in, pos, hash, 8) || !get(in, pos, seed, 4) || !get(in, pos, period, 4) ||
+       (version >= 2 && !get(in, pos, variant, 1)) || !get(in, pos, cycles, 8) || !get(in, pos, count, 4)){
+        error = std::string(fileName) + ": truncated header";
+        return false;
+    }
+
+    if(variant >= chip8::VARIANT_COUNT){
+        error = std::string(fileName) + ": unknown variant";
+        return false;
+    }
+
+    InputLog result{hash, (uint32_t)seed, (uint32_t)period, (chip8::Variant)variant, cycles, {}};
+    uint64_t at = 0;
+    for(uint64_t i=0;i<count;i++){
+        uint64_t delta;
+        if(!getCount(in, pos, delta) || pos >= in.size()){
+            error = std::string(fileName) + ": truncated at event " + std::to_string(i);
+            return false;
+        }
+        uint8_t b = in[pos++];
+        at += delta;
+        result.events.push_back(InputEvent{at, (uint8_t)(b & 0xF), (uint8_t)(b >> 7)});
+    }
+    log = result;
+    return true;
+}
+
+bool loadInputScript(const char* fileName, std::vector<InputEvent>& events, std::string& error){
+    std::ifstream f(fileName);
+    if(!f){
+        error = std::string("could not open ") + fileName;
+        return false;
+    }
+    std::string line;
+    for(int number=1;std::getline(f,line);number++){
+        line = line.substr(0, line.find('#'));
+        std::istringstream in(line);
+        unsigned long long cycle;
+        unsigned key, down;
+        if(!(in >> cycle)) // blank or comment
+            continue;
+        if(!(in >> std::hex >> key >> std::dec >> down) || key > 0xF || down > 1){
+            error = std::string(fileName) + ":" + std::to_string(number) + ": expected \"cycle key 0|1\"";
+            return false;
+        }
+        events.push_back(InputEvent{cycle, (uint8_t)key, (uint8_t)down});
+    }
+    std::stable_sort(events.begin(), events.end(),
+                     [](const InputEvent& a, const InputEvent& b){ return a.cycle < b.cycle; });
+    return true;
+}
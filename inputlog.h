@@ -0,0 +1,86 @@
+#ifndef CHIP8_INPUTLOG_H
+#define CHIP8_INPUTLOG_H
+
+// Input recording and replay
+//
+// A run is fully determined by the ROM, the random seed, the timer period,
+// the variant and the keypad changes with the instruction count each happened at, so
+// that is all an input log holds. Replaying one runs flat out between the
+// changes with any engine and ends in the state the recorded run did.
+//
+// Binary log layout, little endian: "C8IN", version, ROM hash (FNV-1a),
+// seed, timer period, variant, cycles, event count (32, 32, 64, 32, 32, 8,
+// 64, 32 bits, version 1 logs have no variant and ran Modern)
+// then per event the cycles since the previous one as a 7 bit varint and a
+// byte holding the key in the low nibble and the down flag in the top bit.
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "chip8.h"
+
+#define CHIP8_INPUTLOG_VERSION 2
+
+// Key press or release applied once the instance has run `cycle` instructions
+struct InputEvent{
+    uint64_t cycle;
+    uint8_t key;
+    uint8_t down;
+};
+
+struct InputLog{
+    uint64_t romHash;
+    uint32_t seed;
+    uint32_t timerPeriod;
+    chip8::Variant variant;
+    uint64_t cycles; // how long the recorded run went on
+    std::vector<InputEvent> events; // sorted by cycle
+};
+
+uint64_t romHash(const uint8_t* rom, size_t size);
+
+// Collects keypad changes, call sample() whenever the keypad may have been
+// changed and before running on
+class InputRecorder{
+public:
+    InputRecorder();
+
+    void start(const chip8& c, const uint8_t* rom, size_t romSize, uint32_t seed);
+    void sample(const chip8& c);
+    // c went back in time (rewind), forgets what came after
+    void rewound(const chip8& c);
+    // stamps the end of the run
+    void finish(const chip8& c);
+
+    InputLog log;
+
+private:
+    uint8_t keys[16];
+};
+
+bool saveInputLog(const char* fileName, const InputLog& log);
+// Returns false with the reason in error on failure
+bool loadInputLog(const char* fileName, InputLog& log, std::string& error);
+
+// Reads an input script, one "cycle key 0|1" event per line with the key in
+// hex and # starting a comment. Returns false with the line in error on failure
+bool loadInputScript(const char* fileName, std::vector<InputEvent>& events, std::string& error);
+
+// Runs c up to cycles, applying each event once c.cycles reaches it.
+// run(n) has to run exactly n instructions on c with whatever engine
+template<typename Run>
+void runInput(chip8& c, const std::vector<InputEvent>& input, uint64_t cycles, Run run){
+    size_t next = 0;
+    while(c.cycles < cycles){
+        while(next < input.size() && input[next].cycle <= c.cycles){
+            c.keypad[input[next].key & 0xF] = input[next].down;
+            next++;
+        }
+        uint64_t until = cycles;
+        if(next < input.size() && input[next].cycle < until)
+            until = input[next].cycle;
+        run(until - c.cycles);
+    }
+}
+
+#endif
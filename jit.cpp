@@ -0,0 +1,472 @@
+#include "jit.h"
+#include <cstring>
+#include <cstddef>
+
+// native code needs x86-64 and mmap, anything else just interprets
+#if defined(__x86_64__) && !defined(_WIN32)
+#define CHIP8_JIT_X64
+#include <sys/mman.h>
+#endif
+
+// longest run of chip8 instructions put in one block
+#define maxBlockLength 64
+// a block start invalidated this many times is not translated again
+#define maxRewrites 8
+
+#ifdef CHIP8_JIT_X64
+
+namespace {
+
+// host register numbers
+enum { RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7,
+       R8, R9, R10, R11, R12, R13, R14, R15 };
+
+// condition codes for setcc/cmovcc
+enum { CC_B = 0x2, CC_E = 0x4, CC_NE = 0x5, CC_A = 0x7 };
+
+// registers handed out to V0-VF and I, caller saved ones first so short
+// blocks do not need to push anything. rdi holds the chip8 pointer and
+// rax/rcx are scratch
+const int allocOrder[] = { RSI, R8, R9, R10, R11, RDX, RBX, RBP, R12, R13, R14, R15 };
+#define allocCount (int)(sizeof(allocOrder) / sizeof(allocOrder[0]))
+
+bool calleeSaved(int r){
+    return r == RBX || r == RBP || r >= R12;
+}
+
+// Just enough of an x86-64 assembler for the instructions below. All
+// register operations are 32 bit, values are kept zero extended.
+struct Emitter{
+    uint8_t* p;
+
+    void byte(uint8_t b){ *p++ = b; }
+    void word(uint16_t w){ memcpy(p,&w,2); p += 2; }
+    void dword(uint32_t d){ memcpy(p,&d,4); p += 4; }
+
+    void rex(int reg, int index, int base, bool force = false){
+        uint8_t r = 0x40 | ((reg >> 3) & 1) << 2 | ((index >> 3) & 1) << 1 | ((base >> 3) & 1);
+        if(r != 0x40 || force)
+            byte(r);
+    }
+    void modrm(int mod, int reg, int rm){ byte(mod << 6 | (reg & 7) << 3 | (rm & 7)); }
+
+    // op r/m32, r32 with both operands registers
+    void rr(uint8_t opc, int dst, int src){ rex(src,0,dst); byte(opc); modrm(3,src,dst); }
+    void movRR(int dst, int src){ if(dst != src) rr(0x89,dst,src); }
+    void addRR(int dst, int src){ rr(0x01,dst,src); }
+    void subRR(int dst, int src){ rr(0x29,dst,src); }
+    void andRR(int dst, int src){ rr(0x21,dst,src); }
+    void orRR(int dst, int src){ rr(0x09,dst,src); }
+    void xorRR(int dst, int src){ rr(0x31,dst,src); }
+    void cmpRR(int a, int b){ rr(0x39,a,b); } // flags from a - b
+    void testRR(int a, int b){ rr(0x85,a,b); }
+
+    void movRI(int r, uint32_t imm){ rex(0,0,r); byte(0xB8 + (r & 7)); dword(imm); }
+    // 81 /ext id
+    void aluRI(int ext, int r, uint32_t imm){ rex(0,0,r); byte(0x81); modrm(3,ext,r); dword(imm); }
+    void addRI(int r, uint32_t imm){ aluRI(0,r,imm); }
+    void andRI(int r, uint32_t imm){ aluRI(4,r,imm); }
+    void subRI(int r, uint32_t imm){ aluRI(5,r,imm); }
+    void cmpRI(int r, uint32_t imm){ aluRI(7,r,imm); }
+    void shl1(int r){ rex(0,0,r); byte(0xD1); modrm(3,4,r); }
+    void shr1(int r){ rex(0,0,r); byte(0xD1); modrm(3,5,r); }
+    void shrRI(int r, uint8_t imm){ rex(0,0,r); byte(0xC1); modrm(3,5,r); byte(imm); }
+
+    // setcc al then movzx eax, al
+    void setccEax(int cc){ byte(0x0F); byte(0x90 + cc); modrm(3,0,RAX); byte(0x0F); byte(0xB6); modrm(3,RAX,RAX); }
+    void cmov(int cc, int dst, int src){ rex(dst,0,src); byte(0x0F); byte(0x40 + cc); modrm(3,dst,src); }
+
+    // [rdi + disp32]
+    void mem(int reg, int32_t disp){ modrm(2,reg,RDI); dword(disp); }
+    void load8(int r, int32_t disp){ rex(r,0,RDI); byte(0x0F); byte(0xB6); mem(r,disp); }
+    void load16(int r, int32_t disp){ rex(r,0,RDI); byte(0x0F); byte(0xB7); mem(r,disp); }
+    void store8(int r, int32_t disp){ rex(r,0,RDI,true); byte(0x88); mem(r,disp); }
+    void store16(int r, int32_t disp){ byte(0x66); rex(r,0,RDI); byte(0x89); mem(r,disp); }
+    void store16I(int32_t disp, uint16_t imm){ byte(0x66); byte(0xC7); mem(0,disp); word(imm); }
+
+    // [rdi + index*scale + disp32], scale bits 0 = 1, 1 = 2
+    void sib(int reg, int index, int scale, int32_t disp){
+        modrm(2,reg,RSP);
+        byte(scale << 6 | (index & 7) << 3 | RDI);
+        dword(disp);
+    }
+    void load8Index(int r, int index, int32_t disp){ rex(r,index,RDI); byte(0x0F); byte(0xB6); sib(r,index,0,disp); }
+    void load16Index2(int r, int index, int32_t disp){ rex(r,index,RDI); byte(0x0F); byte(0xB7); sib(r,index,1,disp); }
+    void store16IIndex2(int index, int32_t disp, uint16_t imm){ byte(0x66); rex(0,index,RDI); byte(0xC7); sib(0,index,1,disp); word(imm); }
+
+    void push(int r){ rex(0,0,r); byte(0x50 + (r & 7)); }
+    void pop(int r){ rex(0,0,r); byte(0x58 + (r & 7)); }
+    void ret(){ byte(0xC3); }
+};
+
+const int32_t offV = offsetof(chip8, V);
+const int32_t offI = offsetof(chip8, I);
+const int32_t offPc = offsetof(chip8, pc);
+const int32_t offSp = offsetof(chip8, sp);
+const int32_t offStack = offsetof(chip8, stack);
+const int32_t offKeypad = offsetof(chip8, keypad);
+
+// what a block needs from one instruction
+enum Kind { BODY, TERMINATOR, STOP };
+
+Kind classify(uint8_t id){
+    switch(id){
+        case chip8::OP_NULL: case chip8::OP_6: case chip8::OP_7:
+        case chip8::OP_8xy0: case chip8::OP_8xy1: case chip8::OP_8xy2: case chip8::OP_8xy3:
+        case chip8::OP_8xy4: case chip8::OP_8xy5: case chip8::OP_8xy6: case chip8::OP_8xy7:
+        case chip8::OP_8xyE: case chip8::OP_A: case chip8::OP_Fx1E:
+            return BODY;
+        case chip8::OP_1: case chip8::OP_2: case chip8::OP_B: case chip8::OP_00EE:
+        case chip8::OP_3: case chip8::OP_4: case chip8::OP_5: case chip8::OP_9:
+        case chip8::OP_Ex9E: case chip8::OP_ExA1:
+            return TERMINATOR;
+        default:
+            return STOP;
+    }
+}
+
+// the variant's quirks that change the translated code, taken from its
+// chip8::Quirks when a block is built so the code has them baked in
+struct Quirks{
+    bool shiftVy;
+    bool jumpVx;
+};
+
+Quirks quirksOf(chip8::Variant v){
+    Quirks q{false, false};
+    chip8::withQuirks(v, [&q](auto p){ q = Quirks{decltype(p)::shiftVy, decltype(p)::jumpVx}; });
+    return q;
+}
+
+// registers an instruction reads or writes, bit 16 stands for I
+uint32_t uses(const chip8::Instr& in, const Quirks& q){
+    switch(in.id){
+        case chip8::OP_6: case chip8::OP_7: case chip8::OP_3: case chip8::OP_4:
+        case chip8::OP_Ex9E: case chip8::OP_ExA1:
+            return 1u << in.x;
+        case chip8::OP_8xy0: case chip8::OP_8xy1: case chip8::OP_8xy2: case chip8::OP_8xy3:
+        case chip8::OP_5: case chip8::OP_9:
+            return 1u << in.x | 1u << in.y;
+        case chip8::OP_8xy4: case chip8::OP_8xy5: case chip8::OP_8xy7:
+            return 1u << in.x | 1u << in.y | 1u << 0xF;
+        case chip8::OP_8xy6: case chip8::OP_8xyE:
+            return 1u << in.x | 1u << (q.shiftVy ? in.y : in.x) | 1u << 0xF;
+        case chip8::OP_A: return 1u << 16;
+        case chip8::OP_Fx1E: return 1u << in.x | 1u << 16;
+        case chip8::OP_B: return 1u << (q.jumpVx ? in.x : 0);
+        default: return 0;
+    }
+}
+
+// registers an instruction writes
+uint32_t writes(const chip8::Instr& in){
+    switch(in.id){
+        case chip8::OP_6: case chip8::OP_7:
+        case chip8::OP_8xy0: case chip8::OP_8xy1: case chip8::OP_8xy2: case chip8::OP_8xy3:
+            return 1u << in.x;
+        case chip8::OP_8xy4: case chip8::OP_8xy5: case chip8::OP_8xy6: case chip8::OP_8xy7: case chip8::OP_8xyE:
+            return 1u << in.x | 1u << 0xF;
+        case chip8::OP_A: case chip8::OP_Fx1E: return 1u << 16;
+        default: return 0;
+    }
+}
+
+int popcount(uint32_t v){ return __builtin_popcount(v); }
+
+}
+
+Jit::Jit(size_t size) : blocksCompiled(0), blocksInvalidated(0), nativeInstructions(0),
+    interpretedInstructions(0), c(nullptr), variant(chip8::Variant::Modern), code(nullptr), codeSize(size), codeUsed(0){
+    void* m = mmap(nullptr,codeSize,PROT_READ | PROT_WRITE | PROT_EXEC,MAP_PRIVATE | MAP_ANONYMOUS,-1,0);
+    // hosts that refuse writable + executable pages just interpret
+    if(m != MAP_FAILED)
+        code = (uint8_t*)m;
+    noBlock = Block{nullptr,0,0,0};
+    memset(lookup,0,sizeof(lookup));
+    memset(covered,0,sizeof(covered));
+    memset(rewrites,0,sizeof(rewrites));
+}
+
+Jit::~Jit(){
+    detach();
+    flush();
+    if(code)
+        munmap(code,codeSize);
+}
+
+Jit::Block* Jit::compile(uint16_t addr){
+    // worst case code for one instruction plus prologue/epilogue
+    const size_t maxBlockBytes = maxBlockLength * 48 + 128;
+    if(code == nullptr || rewrites[addr] >= maxRewrites)
+        return &noBlock;
+    if(codeUsed + maxBlockBytes > codeSize)
+        flush();
+
+    // first pass: find where the block ends and which registers it needs
+    const Quirks q = quirksOf(variant);
+    chip8::Instr ins[maxBlockLength];
+    int count = 0;
+    uint32_t used = 0, dirty = 0;
+    bool terminated = false;
+    uint16_t a = addr;
+    while(count < maxBlockLength && a <= 0xFFE){
+        chip8::Instr in = chip8::makeInstr((c->memory[a] << 8u) | c->memory[a + 1]);
+        Kind k = classify(in.id);
+        if(k == STOP)
+            break;
+        uint32_t u = used | uses(in, q);
+        if(popcount(u) > allocCount)
+            break;
+        used = u;
+        dirty |= writes(in);
+        ins[count++] = in;
+        a += 2;
+        if(k == TERMINATOR){
+            terminated = true;
+            break;
+        }
+    }
+    if(count == 0 || (count == 1 && ins[0].id == chip8::OP_NULL))
+        return &noBlock;
+
+    // host register for each of V0-VF and I (index 16)
+    int reg[17];
+    int next = 0;
+    for(int r=0;r<17;r++)
+        reg[r] = (used >> r) & 1 ? allocOrder[next++] : -1;
+
+    Emitter e{code + codeUsed};
+    uint8_t* start = e.p;
+
+    for(int r=0;r<17;r++)
+        if(reg[r] >= 0 && calleeSaved(reg[r]))
+            e.push(reg[r]);
+    for(int r=0;r<16;r++)
+        if(reg[r] >= 0)
+            e.load8(reg[r],offV + r);
+    if(reg[16] >= 0)
+        e.load16(reg[16],offI);
+
+    const int F = reg[0xF];
+    uint16_t pcNext = addr;
+    for(int i=0;i<count;i++){
+        const chip8::Instr& in = ins[i];
+        const int X = reg[in.x], Y = reg[in.y], RI = reg[16];
+        // pc as the interpreter sees it while running this instruction
+        pcNext += 2;
+
+        switch(in.id){
+            case chip8::OP_6: e.movRI(X,in.nn); break;
+            case chip8::OP_7: e.addRI(X,in.nn); e.andRI(X,0xFF); break;
+            case chip8::OP_8xy0: e.movRR(X,Y); break;
+            case chip8::OP_8xy1: e.orRR(X,Y); break;
+            case chip8::OP_8xy2: e.andRR(X,Y); break;
+            case chip8::OP_8xy3: e.xorRR(X,Y); break;
+            case chip8::OP_8xy4:
+                // carry comes from the old values, the add then sees the new VF
+                e.movRR(RAX,X); e.addRR(RAX,Y); e.shrRI(RAX,8); e.movRR(F,RAX);
+                e.addRR(X,Y); e.andRI(X,0xFF);
+                break;
+            case chip8::OP_8xy5:
+                e.cmpRR(X,Y); e.setccEax(CC_A); e.movRR(F,RAX);
+                e.subRR(X,Y); e.andRI(X,0xFF);
+                break;
+            // the source goes to rcx first, VF may be the source or the target
+            case chip8::OP_8xy6:
+                e.movRR(RCX,q.shiftVy ? Y : X);
+                e.movRR(RAX,RCX); e.andRI(RAX,0x1); e.movRR(F,RAX);
+                e.shr1(RCX); e.movRR(X,RCX);
+                break;
+            case chip8::OP_8xy7:
+                e.cmpRR(Y,X); e.setccEax(CC_A); e.movRR(F,RAX);
+                e.movRR(RAX,Y); e.subRR(RAX,X); e.andRI(RAX,0xFF); e.movRR(X,RAX);
+                break;
+            case chip8::OP_8xyE:
+                e.movRR(RCX,q.shiftVy ? Y : X);
+                e.movRR(RAX,RCX); e.shrRI(RAX,7); e.movRR(F,RAX);
+                e.shl1(RCX); e.andRI(RCX,0xFF); e.movRR(X,RCX);
+                break;
+            case chip8::OP_A: e.movRI(RI,in.nnn); break;
+            case chip8::OP_Fx1E: e.addRR(RI,X); e.andRI(RI,0xFFFF); break;
+
+            case chip8::OP_1: e.store16I(offPc,in.nnn); break;
+            case chip8::OP_2:
+                e.load16(RAX,offSp);
+                e.store16IIndex2(RAX,offStack,pcNext);
+                e.addRI(RAX,1);
+                e.store16(RAX,offSp);
+                e.store16I(offPc,in.nnn);
+                break;
+            case chip8::OP_00EE:
+                e.load16(RAX,offSp);
+                e.subRI(RAX,1);
+                e.andRI(RAX,0xFFFF);
+                e.store16(RAX,offSp);
+                e.load16Index2(RAX,RAX,offStack);
+                e.store16(RAX,offPc);
+                break;
+            case chip8::OP_B:
+                e.movRR(RAX,reg[q.jumpVx ? in.x : 0]); e.addRI(RAX,in.nnn);
+                e.store16(RAX,offPc);
+                break;
+            case chip8::OP_3: case chip8::OP_4: case chip8::OP_5: case chip8::OP_9:
+            case chip8::OP_Ex9E: case chip8::OP_ExA1: {
+                int cc;
+                if(in.id == chip8::OP_3 || in.id == chip8::OP_4){
+                    e.cmpRI(X,in.nn);
+                    cc = in.id == chip8::OP_3 ? CC_E : CC_NE;
+                }
+                else if(in.id == chip8::OP_5 || in.id == chip8::OP_9){
+                    e.cmpRR(X,Y);
+                    cc = in.id == chip8::OP_5 ? CC_E : CC_NE;
+                }
+                else{
+                    e.load8Index(RCX,X,offKeypad);
+                    e.testRR(RCX,RCX);
+                    cc = in.id == chip8::OP_Ex9E ? CC_NE : CC_E;
+                }
+                e.movRI(RAX,pcNext);
+                e.movRI(RCX,(uint16_t)(pcNext + 2));
+                e.cmov(cc,RAX,RCX);
+                e.store16(RAX,offPc);
+                break;
+            }
+            default: break; // op_NULL
+        }
+    }
+    if(!terminated)
+        e.store16I(offPc,pcNext);
+
+    for(int r=0;r<16;r++)
+        if((dirty >> r) & 1)
+            e.store8(reg[r],offV + r);
+    if((dirty >> 16) & 1)
+        e.store16(reg[16],offI);
+    for(int r=16;r>=0;r--)
+        if(reg[r] >= 0 && calleeSaved(reg[r]))
+            e.pop(reg[r]);
+    e.ret();
+
+    codeUsed += e.p - start;
+
+    Block* b = new Block{(BlockFunc)(void*)start, addr, a, (uint16_t)count};
+    blocks.push_back(b);
+    for(uint16_t i=addr;i<a;i++)
+        covered[i]++;
+    ++blocksCompiled;
+    return b;
+}
+
+#else
+
+Jit::Jit(size_t size) : blocksCompiled(0), blocksInvalidated(0), nativeInstructions(0),
+    interpretedInstructions(0), c(nullptr), variant(chip8::Variant::Modern), code(nullptr), codeSize(size), codeUsed(0){
+    noBlock = Block{nullptr,0,0,0};
+    memset(lookup,0,sizeof(lookup));
+    memset(covered,0,sizeof(covered));
+    memset(rewrites,0,sizeof(rewrites));
+}
+
+Jit::~Jit(){
+    detach();
+    flush();
+}
+
+Jit::Block* Jit::compile(uint16_t){
+    return &noBlock;
+}
+
+#endif
+
+void Jit::attach(chip8& target){
+    detach();
+    flush();
+    memset(rewrites,0,sizeof(rewrites));
+    c = &target;
+    variant = c->variant;
+    c->writeHook = &Jit::onWrite;
+    c->writeHookCtx = this;
+}
+
+void Jit::detach(){
+    if(c && c->writeHookCtx == this){
+        c->writeHook = nullptr;
+        c->writeHookCtx = nullptr;
+    }
+    c = nullptr;
+}
+
+void Jit::onWrite(void* ctx, uint16_t addr, uint16_t len){
+    ((Jit*)ctx)->invalidate(addr,len);
+}
+
+void Jit::run(uint64_t n){
+    // blocks have the quirks they were built for baked in
+    if(c->variant != variant){
+        flush();
+        variant = c->variant;
+    }
+    uint64_t done = 0;
+    while(done < n){
+        Block* b = nullptr;
+        if(c->pc <= 0xFFF){
+            b = lookup[c->pc];
+            if(b == nullptr)
+                b = lookup[c->pc] = compile(c->pc);
+        }
+
+        // the last few instructions of the budget go through the interpreter
+        // when a whole block would overshoot it
+        if(b && b->fn && b->count <= n - done){
+            b->fn(c);
+            c->retire(b->count);
+            done += b->count;
+            nativeInstructions += b->count;
+        }
+        else{
+            c->emulateCycle();
+            ++done;
+            ++interpretedInstructions;
+        }
+    }
+}
+
+void Jit::invalidate(uint16_t addr, uint16_t len){
+    // a failed translation may work now, a slot reads two bytes
+    for(int a = addr - 1; a < addr + len; a++)
+        if(lookup[a & 0xFFF] == &noBlock)
+            lookup[a & 0xFFF] = nullptr;
+
+    bool hit = false;
+    for(int a = addr; a < addr + len && !hit; a++)
+        hit = covered[a & 0xFFF] != 0;
+    if(!hit)
+        return;
+
+    for(size_t i=0;i<blocks.size();){
+        Block* b = blocks[i];
+        // the write may wrap past 0xFFF, blocks never do
+        if(((b->start - addr) & 0xFFF) < len || ((addr - b->start) & 0xFFF) < b->end - b->start){
+            for(uint16_t a=b->start;a<b->end;a++)
+                covered[a]--;
+            lookup[b->start] = nullptr;
+            if(rewrites[b->start] < maxRewrites)
+                rewrites[b->start]++;
+            blocks[i] = blocks.back();
+            blocks.pop_back();
+            delete b;
+            ++blocksInvalidated;
+        }
+        else
+            i++;
+    }
+}
+
+void Jit::flush(){
+    for(Block* b : blocks)
+        delete b;
+    blocks.clear();
+    memset(lookup,0,sizeof(lookup));
+    memset(covered,0,sizeof(covered));
+    codeUsed = 0;
+}
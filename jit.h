@@ -0,0 +1,78 @@
+#ifndef CHIP8_JIT_H
+#define CHIP8_JIT_H
+
+// x86-64 basic block translator for the chip8 core
+//
+// Straight runs of register instructions (6xkk, 7xkk, 8xy*, Annn, Fx1E) are
+// compiled to native code with the V registers and I they touch held in host
+// registers for the length of the block. A block ends on a jump, call, return
+// or skip (1nnn, 2nnn, Bnnn, 00EE, 3xkk, 4xkk, 5xy0, 9xy0, Ex9E, ExA1), which
+// it translates as well, or right before anything else, which is left to
+// emulateCycle(). Blocks are dropped when op_Fx33/op_Fx55 write over them,
+// and all of them when the chip8 switches to another variant.
+//
+// On hosts other than x86-64 (or without mmap) nothing gets translated and
+// run() just interprets.
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include "chip8.h"
+
+class Jit{
+public:
+    explicit Jit(size_t codeSize = 4 << 20);
+    ~Jit();
+
+    // Hooks this translator up to c's memory writes, one chip8 at a time
+    void attach(chip8& c);
+    void detach();
+
+    // Runs n instructions of the attached chip8, natively where a block can
+    // be built and through emulateCycle() everywhere else
+    void run(uint64_t n);
+
+    // Throws away every block built from memory[addr, addr+len)
+    void invalidate(uint16_t addr, uint16_t len);
+    // Throws away every block
+    void flush();
+
+    // counters
+    uint64_t blocksCompiled;
+    uint64_t blocksInvalidated;
+    uint64_t nativeInstructions;
+    uint64_t interpretedInstructions;
+
+private:
+    typedef void (*BlockFunc)(chip8*);
+
+    struct Block{
+        BlockFunc fn;
+        uint16_t start;
+        uint16_t end; // one past the last byte read
+        uint16_t count; // chip8 instructions retired by one run of the block
+    };
+
+    Block* compile(uint16_t addr);
+    static void onWrite(void* ctx, uint16_t addr, uint16_t len);
+
+    chip8* c;
+    chip8::Variant variant; // the blocks were translated for
+    uint8_t* code;
+    size_t codeSize;
+    size_t codeUsed;
+
+    // block starting at each address, noBlock where translation gave nothing
+    Block* lookup[4096];
+    std::vector<Block*> blocks;
+    // number of blocks reading each byte, lets writes outside code skip the scan
+    uint16_t covered[4096];
+    // times the block starting at each address was written over, code that
+    // keeps rewriting itself is left to the interpreter past maxRewrites
+    uint8_t rewrites[4096];
+    Block noBlock;
+
+    Jit(const Jit&) = delete;
+    Jit& operator=(const Jit&) = delete;
+};
+
+#endif
@@ -0,0 +1,288 @@
+#include "lockstep.h"
+#include <cstring>
+
+template<int Lanes>
+Lockstep<Lanes>::Lockstep(chip8* const* lanes) : vectorSteps(0), scalarSteps(0), codeDiffers(0), written(0), mixed(false){
+    for(int l=0;l<Lanes;l++){
+        lane[l] = lanes[l];
+        mixed = mixed || lane[l]->variant != lane[0]->variant;
+    }
+    // pages that already differ never take the shared decode without a byte check
+    for(int page=0;page<64;page++){
+        for(int l=1;l<Lanes;l++){
+            if(memcmp(lane[0]->memory + page*64, lane[l]->memory + page*64, 64)){
+                codeDiffers |= 1ull << page;
+                break;
+            }
+        }
+    }
+}
+
+#if defined(__GNUC__)
+
+namespace {
+
+template<typename M>
+bool anySet(const M& m){
+    uint64_t words[sizeof(M) / 8];
+    memcpy(words, &m, sizeof(m));
+    uint64_t any = 0;
+    for(uint64_t w : words)
+        any |= w;
+    return any != 0;
+}
+
+template<typename M>
+int lanesSet(const M& m){
+    uint64_t words[sizeof(M) / 8];
+    memcpy(words, &m, sizeof(m));
+    int bits = 0;
+    for(uint64_t w : words)
+        bits += __builtin_popcountll(w);
+    return bits / 8;
+}
+
+// dst takes a in the lanes where the mask is set
+template<typename T, typename M>
+void blend(T& dst, const M& m, const T& a){
+    dst = (a & (T)m) | (dst & ~(T)m);
+}
+
+}
+
+template<int Lanes>
+void Lockstep<Lanes>::load(){
+    for(int l=0;l<Lanes;l++){
+        fill(l);
+        timerPeriod[l] = lane[l]->timerPeriod ? lane[l]->timerPeriod : 1;
+        startCycles[l] = lane[l]->cycles;
+        steps[l] = 0;
+        written |= lane[l]->dirtyPages;
+    }
+}
+
+template<int Lanes>
+void Lockstep<Lanes>::store(){
+    for(int l=0;l<Lanes;l++){
+        spill(l);
+        lane[l]->cycles = startCycles[l] + steps[l];
+    }
+}
+
+template<int Lanes>
+void Lockstep<Lanes>::spill(int l){
+    chip8& c = *lane[l];
+    for(int r=0;r<16;r++)
+        c.V[r] = V[r][l];
+    c.I = I[l];
+    c.pc = pc[l];
+    c.delayTimer = delayTimer[l];
+    c.soundTimer = soundTimer[l];
+    c.timerPhase = timerPhase[l];
+}
+
+template<int Lanes>
+void Lockstep<Lanes>::fill(int l){
+    const chip8& c = *lane[l];
+    for(int r=0;r<16;r++)
+        V[r][l] = c.V[r];
+    I[l] = c.I;
+    pc[l] = c.pc;
+    delayTimer[l] = c.delayTimer;
+    soundTimer[l] = c.soundTimer;
+    timerPhase[l] = c.timerPhase;
+}
+
+// chip8::retire() for the lanes in mask, cycles is steps + startCycles
+template<int Lanes>
+void Lockstep<Lanes>::retire(const M8& mask){
+    const U32 m = (U32)__builtin_convertvector(mask, M32);
+    steps -= m;
+    timerPhase -= m;
+    const M32 tick = (timerPhase >= timerPeriod) & (M32)m;
+    timerPhase &= ~(U32)tick;
+    // adding the all ones mask takes one off
+    const M8 tick8 = __builtin_convertvector(tick, M8);
+    delayTimer += (U8)((delayTimer != 0) & tick8);
+    soundTimer += (U8)((soundTimer != 0) & tick8);
+}
+
+// Same bytes at addr in every lane in mask as in the leader
+template<int Lanes>
+bool Lockstep<Lanes>::sameCode(uint16_t addr, const M8& mask, int leader) const{
+    const uint8_t* lead = lane[leader]->memory;
+    const uint16_t next = (addr + 1) & 0xFFF;
+    for(int l=0;l<Lanes;l++){
+        if(mask[l] && (lane[l]->memory[addr] != lead[addr] || lane[l]->memory[next] != lead[next]))
+            return false;
+    }
+    return true;
+}
+
+// Runs in for the lanes in mask, all sitting at the same pc. Returns false
+// without touching anything for instructions with no vector version.
+// uniform comes back false once the lanes might have gone different ways
+template<int Lanes>
+template<class Q>
+bool Lockstep<Lanes>::stepVector(const chip8::Instr& in, const M8& mask, bool& uniform){
+    const U16 m16 = (U16)__builtin_convertvector(mask, M16);
+    U16 next = pc + 2;
+    M8 skip = mask & 0; // taken skips, per lane
+    U8& x = V[in.x];
+    U8& y = V[in.y];
+    U8& f = V[0xF];
+    const U8 m = (U8)mask;
+    uniform = true;
+
+    switch(in.id){
+        case chip8::OP_NULL: break;
+        case chip8::OP_1: next = (next & 0) + in.nnn; break;
+        case chip8::OP_3: skip = x == in.nn; break;
+        case chip8::OP_4: skip = x != in.nn; break;
+        case chip8::OP_5: skip = x == y; break;
+        case chip8::OP_9: skip = x != y; break;
+        case chip8::OP_6: blend(x, m, (x & 0) + in.nn); break;
+        case chip8::OP_7: x += m & in.nn; break;
+        case chip8::OP_8xy0: blend(x, m, y); break;
+        case chip8::OP_8xy1: x |= m & y; break;
+        case chip8::OP_8xy2: x &= ~m | y; break;
+        case chip8::OP_8xy3: x ^= m & y; break;
+        // VF is written before Vx like the handlers do, it matters when x or y is F
+        case chip8::OP_8xy4:
+            blend(f, m, (U8)(y > 0xFF - x) & 1);
+            x += m & y;
+            break;
+        case chip8::OP_8xy5:
+            blend(f, m, (U8)(x > y) & 1);
+            x -= m & y;
+            break;
+        case chip8::OP_8xy6: {
+            const U8 src = Q::shiftVy ? y : x;
+            blend(f, m, src & 1);
+            blend(x, m, src >> 1);
+            break;
+        }
+        case chip8::OP_8xy7:
+            blend(f, m, (U8)(y > x) & 1);
+            blend(x, m, y - x);
+            break;
+        case chip8::OP_8xyE: {
+            const U8 src = Q::shiftVy ? y : x;
+            blend(f, m, src >> 7);
+            blend(x, m, src << 1);
+            break;
+        }
+        case chip8::OP_A: blend(I, m16, (I & 0) + in.nnn); break;
+        case chip8::OP_B:
+            next = __builtin_convertvector(V[Q::jumpVx ? in.x : 0], U16) + in.nnn;
+            uniform = false;
+            break;
+        case chip8::OP_Fx07: blend(x, m, delayTimer); break;
+        case chip8::OP_Fx15: blend(delayTimer, m, x); break;
+        case chip8::OP_Fx18: blend(soundTimer, m, x); break;
+        case chip8::OP_Fx1E: I += m16 & __builtin_convertvector(x, U16); break;
+        case chip8::OP_Fx29: blend(I, m16, __builtin_convertvector(x, U16) * 5 + fontSetStart); break;
+        default: return false;
+    }
+
+    skip &= mask;
+    if(anySet(skip)){
+        next += (U16)__builtin_convertvector(skip, M16) & 2;
+        uniform = uniform && !anySet(mask & ~skip);
+    }
+    blend(pc, m16, next);
+    retire(mask);
+    return true;
+}
+
+template<int Lanes>
+template<class Q>
+void Lockstep<Lanes>::runChunk(uint32_t n){
+    load();
+    bool converged = false;
+    for(;;){
+        const M8 active = __builtin_convertvector(steps < n, M8);
+        if(!anySet(active))
+            break;
+
+        // the lanes at the lowest pc go next, the others catch up or wait
+        // for them, which is where branches that went different ways meet again
+        int leader = 0;
+        while(!active[leader])
+            leader++;
+        uint16_t at = pc[leader];
+        M8 group = active;
+        if(!converged){
+            for(int l=leader+1;l<Lanes;l++){
+                if(active[l] && pc[l] < at){
+                    at = pc[l];
+                    leader = l;
+                }
+            }
+            group &= __builtin_convertvector(pc == at, M8);
+        }
+
+        const uint16_t addr = at & 0xFFF;
+        chip8& lead = *lane[leader];
+        const chip8::Instr& in = lead.fetch(addr);
+        const uint64_t pages = (1ull << (addr >> 6)) | (1ull << (((addr + 1) & 0xFFF) >> 6));
+        bool uniform = false;
+        if((!(pages & (codeDiffers | written)) || sameCode(addr, group, leader)) &&
+           stepVector<Q>(in, group, uniform)){
+            vectorSteps += lanesSet(group);
+            converged = converged && uniform;
+        }
+        else{
+            for(int l=0;l<Lanes;l++){
+                if(!group[l])
+                    continue;
+                spill(l);
+                lane[l]->emulateCycle();
+                fill(l);
+                steps[l]++;
+                written |= lane[l]->dirtyPages;
+                scalarSteps++;
+            }
+            converged = false;
+        }
+
+        if(!converged){
+            const M8 here = active & __builtin_convertvector(pc == pc[leader], M8);
+            converged = !anySet(active & ~here);
+        }
+    }
+    store();
+}
+
+template<int Lanes>
+void Lockstep<Lanes>::run(uint64_t n){
+    if(mixed){
+        for(int l=0;l<Lanes;l++)
+            lane[l]->run(n);
+        scalarSteps += n * Lanes;
+        return;
+    }
+    chip8::withQuirks(lane[0]->variant, [this, n](auto q) mutable{
+        // steps is 32 bits per lane
+        while(n){
+            const uint32_t chunk = n < (1u << 30) ? (uint32_t)n : (1u << 30);
+            this->template runChunk<decltype(q)>(chunk);
+            n -= chunk;
+        }
+    });
+}
+
+#else
+
+template<int Lanes>
+void Lockstep<Lanes>::run(uint64_t n){
+    for(int l=0;l<Lanes;l++)
+        lane[l]->run(n);
+    scalarSteps += n * Lanes;
+}
+
+#endif
+
+template class Lockstep<8>;
+template class Lockstep<16>;
+template class Lockstep<32>;
@@ -0,0 +1,93 @@
+#ifndef CHIP8_LOCKSTEP_H
+#define CHIP8_LOCKSTEP_H
+
+// Lock step engine for many instances of the same ROM
+//
+// V, I, pc, the timers and the instruction count of Lanes instances are held
+// structure of arrays style, one vector per register with a lane per
+// instance, so 6xkk, 7xkk, 8xy*, skips, jumps, Annn, Bnnn, Fx07/15/18/1E/29 run
+// for every lane in a handful of SIMD instructions. Each step picks the
+// lowest pc among the lanes still running and runs it for the lanes sitting
+// there (all of them as long as they agree), lanes elsewhere wait for the
+// group to come round to them. Everything else (draws, calls, memory, keys,
+// random numbers) and code that differs between lanes goes through the lane's
+// own emulateCycle().
+//
+// The vector code is built for each chip8::Quirks and picked by the lanes'
+// variant at run(). Lanes of different variants just run one by one.
+//
+// Needs GCC/Clang vector extensions, build with -mavx2 or -march=native to
+// get real vector registers out of them. Without them each lane just runs
+// on its own.
+#include <cstdint>
+#include "chip8.h"
+
+#if defined(__GNUC__)
+// vector_size will not take a template parameter, so one set of types per lane count
+template<int Lanes> struct LockstepTypes;
+#define CHIP8_LOCKSTEP_TYPES(n) \
+template<> struct LockstepTypes<n>{ \
+    typedef uint8_t U8 __attribute__((vector_size(n))); \
+    typedef int8_t M8 __attribute__((vector_size(n))); \
+    typedef uint16_t U16 __attribute__((vector_size(n * 2))); \
+    typedef int16_t M16 __attribute__((vector_size(n * 2))); \
+    typedef uint32_t U32 __attribute__((vector_size(n * 4))); \
+    typedef int32_t M32 __attribute__((vector_size(n * 4))); \
+};
+CHIP8_LOCKSTEP_TYPES(8)
+CHIP8_LOCKSTEP_TYPES(16)
+CHIP8_LOCKSTEP_TYPES(32)
+#undef CHIP8_LOCKSTEP_TYPES
+#endif
+
+// Lanes is 8, 16 or 32. The vectors want up to 128 byte alignment which
+// operator new does not give before C++17, keep it on the stack or static
+template<int Lanes>
+class Lockstep{
+public:
+    // lanes has to point at Lanes instances with the same ROM already loaded,
+    // their state is taken at the start of every run() and written back at the end
+    explicit Lockstep(chip8* const* lanes);
+
+    // Runs n instructions on every lane
+    void run(uint64_t n);
+
+    uint64_t vectorSteps; // instructions run for a group of lanes at once
+    uint64_t scalarSteps; // lane instructions that went through emulateCycle()
+
+private:
+    chip8* lane[Lanes];
+    uint64_t codeDiffers; // 64 byte pages that were not the same in every lane
+    uint64_t written; // pages any lane wrote since its ROM was loaded
+    bool mixed; // lanes of different variants, nothing runs in lock step
+
+#if defined(__GNUC__)
+    typedef typename LockstepTypes<Lanes>::U8 U8;
+    typedef typename LockstepTypes<Lanes>::M8 M8;
+    typedef typename LockstepTypes<Lanes>::U16 U16;
+    typedef typename LockstepTypes<Lanes>::M16 M16;
+    typedef typename LockstepTypes<Lanes>::U32 U32;
+    typedef typename LockstepTypes<Lanes>::M32 M32;
+
+    U8 V[16];
+    U16 I;
+    U16 pc;
+    U8 delayTimer;
+    U8 soundTimer;
+    U32 timerPhase;
+    U32 timerPeriod;
+    U32 steps; // instructions run by each lane in the current chunk
+    uint64_t startCycles[Lanes];
+
+    void load();
+    void store();
+    void spill(int l);
+    void fill(int l);
+    void retire(const M8& mask);
+    template<class Q> void runChunk(uint32_t n);
+    template<class Q> bool stepVector(const chip8::Instr& in, const M8& mask, bool& uniform);
+    bool sameCode(uint16_t addr, const M8& mask, int leader) const;
+#endif
+};
+
+#endif
@@ -0,0 +1,428 @@
+#include <SDL2/SDL.h>
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include "chip8.h"
+#include "romfile.h"
+#include "triplebuffer.h"
+#include "beeper.h"
+#include "rewind.h"
+#include "inputlog.h"
+#ifdef CHIP8_DEBUG
+#include "gdbstub.h"
+
+// set with -gdb, the emulation thread answers it and runs the ROM through it
+static GdbStub* gdbStub = nullptr;
+#endif
+
+// What the emulation thread hands the render thread, the display as the core keeps it
+struct Frame{
+    uint64_t gfx[screen_height];
+};
+
+void Emulate(chip8& c, uint32_t ipf, TripleBuffer<Frame>& frames, Beeper& beeper, Rewind& history, InputRecorder* recorder,
+             const std::atomic<uint16_t>& keys, const std::atomic<bool>& rewinding, const std::atomic<bool>& quit);
+void Update(const Frame& frame, uint64_t* shown, uint32_t* pixels, int pitch, SDL_Renderer* renderer,SDL_Texture* texture);
+bool ProcessInput(uint8_t* keys, bool& rewinding);
+
+static void usage(const char* name){
+    std::cerr << "usage: " << name << " [rom] [-ipf instructionsPerFrame] [-abuf deviceSamples] [-aqueue frames] [-rewind megabytes] [-seed n] [-variant modern|cosmac|schip|xochip] [-record inputlog] [-gdb port]" << std::endl;
+}
+
+// usage: main.exe [rom] [-ipf instructionsPerFrame] [-abuf deviceSamples] [-aqueue frames] [-rewind megabytes]
+//                 [-seed n] [-variant modern|cosmac|schip|xochip] [-record inputlog] [-gdb port]
+// holding backspace runs time backwards, -record writes the session out for headless -replay
+// -gdb port lets a GDB remote protocol client attach on localhost:port at any
+// time and stop the game (see gdbstub.h), needs a -DCHIP8_DEBUG build
+int main(int argc, char* argv[]){
+    const char* fileName = "tetris.rom";
+    uint32_t ipf = 10;
+    int audioSamples = 512;
+    int audioQueue = 8;
+    size_t rewindMegabytes = 4;
+    // random unless given, the recording keeps it either way
+    uint32_t seed = (uint32_t)std::chrono::steady_clock::now().time_since_epoch().count();
+    const char* recordFile = nullptr;
+    chip8::Variant variant = chip8::Variant::Modern;
+    uint16_t gdbPort = 0;
+    for(int i=1;i<argc;i++){
+        if(!strcmp(argv[i],"-ipf") && i+1 < argc)
+            ipf = strtoul(argv[++i],NULL,0);
+        else if(!strcmp(argv[i],"-rewind") && i+1 < argc)
+            rewindMegabytes = strtoul(argv[++i],NULL,0);
+        else if(!strcmp(argv[i],"-seed") && i+1 < argc)
+            seed = strtoul(argv[++i],NULL,0);
+        else if(!strcmp(argv[i],"-variant") && i+1 < argc){
+            // a misspelt variant is not a file name
+            if(!chip8_parseVariant(argv[++i],variant)){
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        else if(!strcmp(argv[i],"-record") && i+1 < argc)
+            recordFile = argv[++i];
+        else if(!strcmp(argv[i],"-gdb") && i+1 < argc)
+            gdbPort = (uint16_t)strtoul(argv[++i],NULL,0);
+        else if(!strcmp(argv[i],"-abuf") && i+1 < argc)
+            audioSamples = atoi(argv[++i]);
+        else if(!strcmp(argv[i],"-aqueue") && i+1 < argc)
+            audioQueue = atoi(argv[++i]);
+        else
+            fileName = argv[i];
+    }
+    if(ipf == 0)
+        ipf = 1;
+
+    RomFile rom;
+    std::string error;
+    if(!rom.open(fileName, error)){
+        std::cerr << error << std::endl;
+        return 1;
+    }
+
+    chip8 c;
+    c.loadProgram(rom.data(), rom.size());
+    std::unique_ptr<chip8::Code> code(new chip8::Code);
+    c.decodeAll(*code);
+    // the timers tick once per frame
+    c.timerPeriod = ipf;
+    c.seed(seed);
+    c.variant = variant;
+
+#ifdef CHIP8_DEBUG
+    Debugger debugger;
+    GdbStub gdb(debugger);
+    if(gdbPort){
+        debugger.attach(c);
+        if(!gdb.listen(gdbPort, error)){
+            std::cerr << error << std::endl;
+            return 1;
+        }
+        gdbStub = &gdb;
+    }
+#else
+    if(gdbPort){
+        std::cerr << "-gdb needs a build with -DCHIP8_DEBUG" << std::endl;
+        return 1;
+    }
+#endif
+
+    InputRecorder recorder;
+    if(recordFile)
+        recorder.start(c, rom.data(), rom.size(), seed);
+
+    SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO);
+    Beeper beeper(audioQueue);
+    if(!beeper.open(audioSamples))
+        std::cerr << "no audio: " << SDL_GetError() << std::endl;
+    SDL_Window* window = SDL_CreateWindow("CHIP 8 Emu", 0, 0, screen_width * 10, screen_height * 10, SDL_WINDOW_SHOWN);
+    // presenting waits for vsync, so the screen is redrawn at most once per host refresh
+    SDL_Renderer* renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+    SDL_Texture* texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING, screen_width, screen_height);
+
+    // the core keeps 1 bit per pixel, expanded here only when a frame goes out
+    uint32_t pixels[screen_width * screen_height];
+    int videoPitch = sizeof(pixels[0])*screen_width;
+    // what the texture holds, all ones so the first frame uploads every row
+    uint64_t shown[screen_height];
+    memset(shown,0xFF,sizeof(shown));
+
+    // Emulation runs on its own thread so a slow present never holds it up,
+    // this one only polls input and draws the newest finished frame
+    TripleBuffer<Frame> frames;
+    Rewind history(rewindMegabytes << 20);
+    std::atomic<uint16_t> keys(0);
+    std::atomic<bool> rewinding(false);
+    std::atomic<bool> quit(false);
+    std::thread emulation(Emulate, std::ref(c), ipf, std::ref(frames), std::ref(beeper), std::ref(history),
+                          recordFile ? &recorder : nullptr, std::cref(keys), std::cref(rewinding), std::cref(quit));
+
+    uint8_t keypad[16] = {0};
+    bool rewindKey = false;
+	while(ProcessInput(keypad, rewindKey)){
+		uint16_t down = 0;
+		for(int k=0;k<16;k++)
+			down |= keypad[k] << k;
+		keys.store(down, std::memory_order_relaxed);
+		rewinding.store(rewindKey, std::memory_order_relaxed);
+
+		if (frames.update())
+			Update(frames.readBuffer(), shown, pixels, videoPitch, renderer, texture);
+		else
+			SDL_Delay(1); // nothing new to draw
+	}
+
+    quit = true;
+    emulation.join();
+    if(recordFile){
+        recorder.finish(c);
+        if(!saveInputLog(recordFile, recorder.log))
+            std::cerr << "could not write " << recordFile << std::endl;
+    }
+    beeper.close();
+    std::cerr << "audio: " << beeper.underruns << " underruns, " << beeper.overflows << " overflows, "
+              << beeper.skipped << " skipped, latency " << beeper.latencyMs() << " ms (max " << beeper.maxLatencyMs() << " ms)" << std::endl;
+    SDL_DestroyTexture(texture);
+    SDL_DestroyRenderer(renderer);
+    SDL_DestroyWindow(window);
+    SDL_Quit();
+    return 0;
+}
+
+// Emulation thread: every 1/60 s runs ipf instructions, queues the beeper
+// state for the frame and publishes the display if it changed. After a stall up to maxCatchUp late frames are run
+// back to back, anything older is dropped. Every frame goes into history, while rewinding
+// each frame steps back one instead. recorder, if given, sees every keypad change
+void Emulate(chip8& c, uint32_t ipf, TripleBuffer<Frame>& frames, Beeper& beeper, Rewind& history, InputRecorder* recorder,
+             const std::atomic<uint16_t>& keys, const std::atomic<bool>& rewinding, const std::atomic<bool>& quit){
+    const auto framePeriod = std::chrono::nanoseconds(1000000000 / 60);
+    const int maxCatchUp = 4;
+    uint64_t droppedFrames = 0;
+    auto nextFrame = std::chrono::steady_clock::now();
+
+	while(!quit.load(std::memory_order_relaxed)){
+		auto now = std::chrono::steady_clock::now();
+		int due = 0;
+		while (nextFrame <= now && due < maxCatchUp){
+			nextFrame += framePeriod;
+			due++;
+		}
+		if (nextFrame <= now){
+			uint64_t late = (now - nextFrame) / framePeriod + 1;
+			droppedFrames += late;
+			nextFrame += late * framePeriod;
+			std::cerr << "stalled, dropped " << late << " frames (" << droppedFrames << " total)" << std::endl;
+		}
+
+		uint16_t down = keys.load(std::memory_order_relaxed);
+		for (int k = 0; k < 16; k++)
+			c.keypad[k] = (down >> k) & 1;
+
+		bool back = rewinding.load(std::memory_order_relaxed);
+		for (int frame = 0; frame < due; frame++){
+			if (back){
+				if (history.rewind(c, 1) && recorder)
+					recorder->rewound(c);
+				beeper.push(false);
+				continue;
+			}
+			if (recorder)
+				recorder->sample(c);
+#ifdef CHIP8_DEBUG
+			// stopped under the debugger the frame stands still
+			if (gdbStub){
+				if (gdbStub->stopped())
+					continue;
+				gdbStub->run(ipf);
+			}
+			else
+#endif
+			c.run(ipf);
+			history.push(c);
+			beeper.push(c.soundTimer > 0);
+		}
+
+		if (c.dirtyRows){
+			memcpy(frames.writeBuffer().gfx, c.gfx, sizeof(c.gfx));
+			frames.publish();
+			c.dirtyRows = 0;
+		}
+
+#ifdef CHIP8_DEBUG
+		// answer the debugger while waiting for the next frame
+		if (gdbStub){
+			for (auto now = std::chrono::steady_clock::now(); now < nextFrame; now = std::chrono::steady_clock::now())
+				gdbStub->poll((int)std::chrono::duration_cast<std::chrono::milliseconds>(nextFrame - now).count() + 1);
+			continue;
+		}
+#endif
+		// sleep off what is left of the frame instead of spinning
+		std::this_thread::sleep_until(nextFrame);
+	}
+}
+
+// Updates key from pending SDL events, false once the window was closed
+bool ProcessInput(uint8_t* key, bool& rewinding){
+    SDL_Event event;
+	while(SDL_PollEvent(&event)){
+        if(event.type == SDL_QUIT)
+            return false;
+        if(event.type == SDL_KEYDOWN){
+
+            switch(event.key.keysym.sym){
+                case SDLK_x:
+                    key[0x0] = 1;
+                    break;
+
+                case SDLK_1:
+                    key[0x1] = 1;
+                    break;
+
+                case SDLK_2:
+                    key[0x2] = 1;
+                    break;
+
+                case SDLK_3:
+                    key[0x3] = 1;
+                    break;
+
+                case SDLK_q:
+                    key[0x4] = 1;
+                    break;
+
+                case SDLK_w:
+                    key[0x5] = 1;
+                    break;
+
+                case SDLK_e:
+                    key[0x6] = 1;
+                    break;
+
+                case SDLK_a:
+                    key[0x7] = 1;
+                    break;
+
+                case SDLK_s:
+                    key[0x8] = 1;
+                    break;
+
+                case SDLK_d:
+                    key[0x9] = 1;
+                    break;
+
+                case SDLK_z:
+                    key[0xA] = 1;
+                    break;
+
+                case SDLK_c:
+                    key[0xB] = 1;
+                    break;
+
+                case SDLK_4:
+                    key[0xC] = 1;
+                    break;
+
+                case SDLK_r:
+                    key[0xD] = 1;
+                    break;
+
+                case SDLK_f:
+                    key[0xE] = 1;
+                    break;
+
+                case SDLK_v:
+                    key[0xF] = 1;
+                    break;
+
+                case SDLK_BACKSPACE:
+                    rewinding = true;
+                    break;
+                }
+        }
+        if(event.type == SDL_KEYUP){
+            switch(event.key.keysym.sym){
+                case SDLK_x:
+                    key[0x0] = 0;
+                    break;
+
+                case SDLK_1:
+                    key[0x1] = 0;
+                    break;
+
+                case SDLK_2:
+                    key[0x2] = 0;
+                    break;
+
+                case SDLK_3:
+                    key[0x3] = 0;
+                    break;
+
+                case SDLK_q:
+                    key[0x4] = 0;
+                    break;
+
+                case SDLK_w:
+                    key[0x5] = 0;
+                    break;
+
+                case SDLK_e:
+                    key[0x6] = 0;
+                    break;
+
+                case SDLK_a:
+                    key[0x7] = 0;
+                    break;
+
+                case SDLK_s:
+                    key[0x8] = 0;
+                    break;
+
+                case SDLK_d:
+                    key[0x9] = 0;
+                    break;
+
+                case SDLK_z:
+                    key[0xA] = 0;
+                    break;
+
+                case SDLK_c:
+                    key[0xB] = 0;
+                    break;
+
+                case SDLK_4:
+                    key[0xC] = 0;
+                    break;
+
+                case SDLK_r:
+                    key[0xD] = 0;
+                    break;
+
+                case SDLK_f:
+                    key[0xE] = 0;
+                    break;
+
+                case SDLK_v:
+                    key[0xF] = 0;
+                    break;
+
+                case SDLK_BACKSPACE:
+                    rewinding = false;
+                    break;
+                }
+            }
+	}
+    return true;
+}
+
+// Uploads the rows of frame that differ from what the texture shows, one
+// texture update per run of consecutive rows, then presents
+void Update(const Frame& frame, uint64_t* shown, uint32_t* pixels, int pitch, SDL_Renderer* renderer,SDL_Texture* texture){
+    int row = 0;
+    while(row < screen_height){
+        if(frame.gfx[row] == shown[row]){
+            row++;
+            continue;
+        }
+        int first = row;
+        while(row < screen_height && frame.gfx[row] != shown[row]){
+            shown[row] = frame.gfx[row];
+            row++;
+        }
+
+        SDL_Rect rect = {0, first, screen_width, row - first};
+        uint32_t* start = pixels + first * screen_width;
+        chip8::expandRows(frame.gfx, start, first, row - first);
+        SDL_UpdateTexture(texture, &rect, start, pitch);
+    }
+
+	SDL_RenderClear(renderer);
+    SDL_RenderCopy(renderer, texture, nullptr, nullptr);
+    SDL_RenderPresent(renderer);
+}
@@ -0,0 +1,42 @@
+#include "pool.h"
+#include <new>
+#include <type_traits>
+
+// reset() memcpys over live instances
+static_assert(std::is_trivially_copyable<chip8>::value, "chip8 has to stay trivially copyable");
+
+InstancePool::InstancePool(size_t count) : count(count){
+    pristine = new chip8;
+    // raw storage, slots only get their bytes from the image in acquire()
+    slots = static_cast<chip8*>(::operator new(count * sizeof(chip8)));
+    freeList.reserve(count);
+    for(size_t i=count;i>0;i--)
+        freeList.push_back(slots + i - 1);
+}
+
+InstancePool::~InstancePool(){
+    ::operator delete(slots);
+    delete pristine;
+}
+
+void InstancePool::prime(){
+    codes.emplace_back(new chip8::Code);
+    pristine->decodeAll(*codes.back());
+}
+
+chip8* InstancePool::acquire(){
+    if(freeList.empty())
+        return nullptr;
+    chip8* c = freeList.back();
+    freeList.pop_back();
+    reset(*c);
+    return c;
+}
+
+void InstancePool::release(chip8* c){
+    freeList.push_back(c);
+}
+
+void InstancePool::reset(chip8& c) const{
+    memcpy(&c, pristine, sizeof(chip8));
+}
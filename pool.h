@@ -0,0 +1,50 @@
+#ifndef CHIP8_POOL_H
+#define CHIP8_POOL_H
+
+// Arena of chip8 instances for tools that go through a lot of them
+//
+// All instances live in one allocation and are never constructed one by
+// one: acquire() and reset() copy a pristine image over the slot, which is
+// a single memcpy since chip8 holds no pointers of its own. The image can
+// have a ROM loaded and decoded into a chip8::Code the pool keeps (prime()),
+// so a reset instance starts with nothing left to load or decode and all of
+// them share the one decoding.
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include "chip8.h"
+
+class InstancePool{
+public:
+    explicit InstancePool(size_t count);
+    ~InstancePool();
+
+    InstancePool(const InstancePool&) = delete;
+    InstancePool& operator=(const InstancePool&) = delete;
+
+    // What every reset starts from, a freshly constructed chip8 until
+    // changed. Changes only reach instances on their next reset
+    chip8& image(){ return *pristine; }
+
+    // Decodes all of the image's memory for it and every instance reset
+    // after, worth it once it holds a ROM. Instances reset before keep the
+    // decoding they had, it stays until the pool goes
+    void prime();
+
+    // A free instance reset to the image, nullptr once all are handed out
+    chip8* acquire();
+    void release(chip8* c);
+    void reset(chip8& c) const;
+
+    size_t size() const{ return count; }
+    size_t available() const{ return freeList.size(); }
+
+private:
+    size_t count;
+    chip8* pristine;
+    chip8* slots;
+    std::vector<chip8*> freeList;
+    std::vector<std::unique_ptr<chip8::Code>> codes; // one per prime()
+};
+
+#endif
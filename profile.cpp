@@ -0,0 +1,79 @@
+#include "profile.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <vector>
+
+void Chip8Profile::clear(){
+    memset(count, 0, sizeof(count));
+    memset(ticks, 0, sizeof(ticks));
+    memset(pcHits, 0, sizeof(pcHits));
+}
+
+void writeProfileText(std::ostream& out, const Chip8Profile& p){
+    uint64_t totalCount = 0, totalTicks = 0;
+    std::vector<int> ops;
+    for(int op=0;op<chip8::OP_COUNT;op++){
+        totalCount += p.count[op];
+        totalTicks += p.ticks[op];
+        if(p.count[op])
+            ops.push_back(op);
+    }
+    std::sort(ops.begin(), ops.end(), [&p](int a, int b){ return p.ticks[a] > p.ticks[b]; });
+
+    out << std::left << std::setw(10) << "handler" << std::right << std::setw(14) << "count"
+        << std::setw(16) << "ticks" << std::setw(10) << "ticks/op" << std::setw(8) << "time%" << std::endl;
+    for(int op : ops){
+        out << std::left << std::setw(10) << chip8_opnames[op] << std::right
+            << std::setw(14) << p.count[op] << std::setw(16) << p.ticks[op]
+            << std::fixed << std::setprecision(1)
+            << std::setw(10) << (double)p.ticks[op] / p.count[op]
+            << std::setw(8) << (totalTicks ? 100.0 * p.ticks[op] / totalTicks : 0) << std::endl;
+    }
+    out << std::left << std::setw(10) << "total" << std::right << std::setw(14) << totalCount
+        << std::setw(16) << totalTicks << std::endl;
+
+    std::vector<int> pcs;
+    for(int pc=0;pc<4096;pc++){
+        if(p.pcHits[pc])
+            pcs.push_back(pc);
+    }
+    std::sort(pcs.begin(), pcs.end(), [&p](int a, int b){ return p.pcHits[a] > p.pcHits[b]; });
+    if(pcs.size() > 20)
+        pcs.resize(20);
+    out << std::endl << "hottest addresses" << std::endl;
+    for(int pc : pcs){
+        out << "  " << std::hex << std::setw(3) << std::setfill('0') << pc << std::dec << std::setfill(' ')
+            << std::setw(14) << p.pcHits[pc] << std::setprecision(1)
+            << std::setw(8) << (totalCount ? 100.0 * p.pcHits[pc] / totalCount : 0) << "%" << std::endl;
+    }
+}
+
+void writeProfileJson(std::ostream& out, const Chip8Profile& p){
+    out << "{\"handlers\":[";
+    bool first = true;
+    for(int op=0;op<chip8::OP_COUNT;op++){
+        if(!p.count[op])
+            continue;
+        out << (first ? "" : ",") << "{\"name\":\"" << chip8_opnames[op] << "\",\"count\":" << p.count[op]
+            << ",\"ticks\":" << p.ticks[op] << "}";
+        first = false;
+    }
+    out << "],\"pc\":[";
+    for(int pc=0;pc<4096;pc++)
+        out << (pc ? "," : "") << p.pcHits[pc];
+    out << "]}" << std::endl;
+}
+
+bool writeProfile(const char* fileName, const Chip8Profile& p){
+    std::ofstream f(fileName);
+    if(!f)
+        return false;
+    size_t len = strlen(fileName);
+    if(len >= 5 && !strcmp(fileName + len - 5, ".json"))
+        writeProfileJson(f, p);
+    else
+        writeProfileText(f, p);
+    return (bool)f;
+}
@@ -0,0 +1,42 @@
+#ifndef CHIP8_PROFILE_H
+#define CHIP8_PROFILE_H
+
+// Per handler profiler, built in with -DCHIP8_PROFILE (every file, it changes
+// the chip8 layout). Without it none of this is referenced from the core
+// and the dispatch loops are exactly what they always were.
+//
+// Setting chip8::profile makes run() take every instruction through
+// emulateCycle() whatever the engine, counting each handler, the host
+// cycles spent in it (rdtsc, steady_clock elsewhere) and the hits per pc.
+// The JIT and aot engines bypass it, their code is not counted.
+#include <cstdint>
+#include <ostream>
+#include "chip8.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+inline uint64_t profileClock(){ return __rdtsc(); }
+#else
+#include <chrono>
+inline uint64_t profileClock(){
+    return std::chrono::steady_clock::now().time_since_epoch().count();
+}
+#endif
+
+struct Chip8Profile{
+    uint64_t count[chip8::OP_COUNT];
+    uint64_t ticks[chip8::OP_COUNT];
+    uint64_t pcHits[4096];
+
+    Chip8Profile(){ clear(); }
+    void clear();
+};
+
+// Handlers by time spent and the hottest addresses
+void writeProfileText(std::ostream& out, const Chip8Profile& p);
+// {"handlers":[{"name","count","ticks"}...],"pc":[4096 counts]}
+void writeProfileJson(std::ostream& out, const Chip8Profile& p);
+// JSON if the name ends in .json, text otherwise
+bool writeProfile(const char* fileName, const Chip8Profile& p);
+
+#endif
@@ -0,0 +1,202 @@
+#include "rewind.h"
+#include "savestate.h"
+#include <cstring>
+
+namespace {
+
+uint8_t* putCount(uint8_t* out, size_t n){
+    while(n >= 0x80){
+        *out++ = (uint8_t)(n | 0x80);
+        n >>= 7;
+    }
+    *out++ = (uint8_t)n;
+    return out;
+}
+
+// nullptr if the count runs past end or does not fit a size_t
+const uint8_t* getCount(const uint8_t* in, const uint8_t* end, size_t& n){
+    n = 0;
+    for(int shift=0;in < end && shift < 64;shift+=7){
+        uint8_t b = *in++;
+        n |= (size_t)(b & 0x7F) << shift;
+        if(!(b & 0x80))
+            return in;
+    }
+    return nullptr;
+}
+
+// Writes a ^ ref as (equal count, differing count, differing bytes XORed)
+// runs, no ref is all zeros. out needs room for 2n + 16 bytes
+size_t pack(const uint8_t* a, const uint8_t* ref, size_t n, uint8_t* out){
+    uint8_t* o = out;
+    size_t i = 0;
+    while(i < n){
+        size_t start = i;
+        if(ref){
+            // whole words first, most of memory never changes
+            while(i + 8 <= n && !memcmp(a + i, ref + i, 8))
+                i += 8;
+            while(i < n && a[i] == ref[i])
+                i++;
+        }
+        else{
+            while(i < n && a[i] == 0)
+                i++;
+        }
+        if(i == n)
+            break;
+        o = putCount(o, i - start);
+
+        // a differing run ends at 4 equal bytes in a row, fewer cost more to
+        // code as a run of their own
+        start = i;
+        size_t same = 0;
+        for(;i < n && same < 4;i++)
+            same = a[i] == (ref ? ref[i] : 0) ? same + 1 : 0;
+        i -= same;
+        o = putCount(o, i - start);
+        for(size_t k=start;k<i;k++)
+            *o++ = a[k] ^ (ref ? ref[k] : 0);
+    }
+    return o - out;
+}
+
+// false if the runs do not fit in n bytes or in size, out is then garbage
+bool unpack(const uint8_t* in, size_t size, const uint8_t* ref, uint8_t* out, size_t n){
+    if(ref)
+        memcpy(out, ref, n);
+    else
+        memset(out, 0, n);
+    const uint8_t* end = in + size;
+    size_t i = 0;
+    while(in < end){
+        size_t skip, count;
+        in = getCount(in, end, skip);
+        if(!in)
+            return false;
+        in = getCount(in, end, count);
+        if(!in || skip > n - i)
+            return false;
+        i += skip;
+        if(count > n - i || count > (size_t)(end - in))
+            return false;
+        for(size_t k=0;k<count;k++)
+            out[i++] ^= *in++;
+    }
+    return true;
+}
+
+}
+
+Rewind::Rewind(size_t capacity, uint32_t keyInterval)
+    : ring(capacity), used(0), keyInterval(keyInterval ? keyInterval : 1), sinceKey(0),
+      key(stateSize()), state(stateSize()), packed(2 * stateSize() + 16){
+}
+
+void Rewind::clear(){
+    entries.clear();
+    used = 0;
+    sinceKey = 0;
+}
+
+// Drops the oldest frame, and with it the frames after it that were stored
+// against it if it was a keyframe
+void Rewind::dropOldest(){
+    do{
+        used -= entries.front().size;
+        entries.pop_front();
+    }while(!entries.empty() && !entries.front().key);
+}
+
+// Finds room for size bytes after the newest frame, wrapping to the start
+// of the ring and dropping old frames in the way
+bool Rewind::place(size_t size, size_t& offset){
+    if(size > ring.size())
+        return false;
+    offset = entries.empty() ? 0 : entries.back().offset + entries.back().size;
+    auto overlaps = [&](const Entry& e){
+        return e.offset < offset + size && offset < e.offset + e.size;
+    };
+    if(offset + size > ring.size()){
+        // the oldest frames are the ones left at the end of the ring, not
+        // those at the start, so the front is no guide here: drop from it
+        // until nothing is left in [0, size)
+        offset = 0;
+        for(;;){
+            bool clash = false;
+            for(const Entry& e : entries)
+                clash = clash || overlaps(e);
+            if(!clash)
+                break;
+            dropOldest();
+        }
+    }
+    // not wrapping, the frames after the newest are the oldest in order
+    while(!entries.empty() && overlaps(entries.front()))
+        dropOldest();
+    return true;
+}
+
+void Rewind::push(const chip8& c){
+    saveState(c, state.data());
+    const size_t n = state.size();
+
+    bool asKey = entries.empty() || sinceKey + 1 >= keyInterval;
+    for(;;){
+        size_t size = pack(state.data(), asKey ? nullptr : key.data(), n, packed.data());
+        size_t offset;
+        if(!place(size, offset)){
+            clear(); // a frame bigger than the whole ring, history starts over
+            return;
+        }
+        // making room took the keyframe this was stored against
+        if(!asKey && entries.empty()){
+            asKey = true;
+            continue;
+        }
+        memcpy(ring.data() + offset, packed.data(), size);
+        entries.push_back(Entry{offset, size, asKey});
+        used += size;
+        break;
+    }
+
+    if(asKey){
+        key.swap(state);
+        sinceKey = 0;
+    }
+    else
+        sinceKey++;
+}
+
+bool Rewind::rewind(chip8& c, size_t frames){
+    if(frames >= entries.size())
+        return false;
+    const size_t target = entries.size() - 1 - frames;
+    // the oldest frame is always a keyframe
+    size_t keyAt = target;
+    while(!entries[keyAt].key)
+        keyAt--;
+
+    const size_t n = state.size();
+    const Entry& k = entries[keyAt];
+    bool good = unpack(ring.data() + k.offset, k.size, nullptr, key.data(), n);
+    if(good && keyAt != target){
+        const Entry& e = entries[target];
+        good = unpack(ring.data() + e.offset, e.size, key.data(), state.data(), n);
+    }
+    else if(good)
+        memcpy(state.data(), key.data(), n);
+
+    // a frame that does not decode leaves c alone, and since key now holds
+    // garbage the next frame pushed has to start the history over
+    if(!good || !loadState(c, state.data(), n)){
+        clear();
+        return false;
+    }
+    while(entries.size() > target + 1){
+        used -= entries.back().size;
+        entries.pop_back();
+    }
+    sinceKey = target - keyAt;
+    return true;
+}
@@ -0,0 +1,57 @@
+#ifndef CHIP8_REWIND_H
+#define CHIP8_REWIND_H
+
+// Rewind history, one save state per frame in a fixed size ring
+//
+// Every keyInterval frames a keyframe is stored, the frames in between are
+// stored as the XOR of their state against that keyframe, run length coded
+// so the unchanged bytes (nearly all of them) cost next to nothing. Going
+// back to any frame decodes at most its keyframe and itself. When the ring
+// is full the oldest keyframe goes together with the frames that need it.
+#include <cstdint>
+#include <cstddef>
+#include <deque>
+#include <vector>
+#include "chip8.h"
+
+class Rewind{
+public:
+    // capacity is the ring size in bytes
+    explicit Rewind(size_t capacity = 4 << 20, uint32_t keyInterval = 60);
+
+    // Stores the state of c as the newest frame
+    void push(const chip8& c);
+
+    // Restores c to the state frames pushes back (0 is the newest) and forgets
+    // everything after it, false if the history does not reach that far or
+    // the frame does not decode (c is left alone and the history cleared)
+    bool rewind(chip8& c, size_t frames = 1);
+
+    void clear();
+
+    size_t frames() const{ return entries.size(); }
+    size_t bytesUsed() const{ return used; }
+    size_t capacity() const{ return ring.size(); }
+
+private:
+    struct Entry{
+        size_t offset;
+        size_t size;
+        bool key;
+    };
+
+    bool place(size_t size, size_t& offset);
+    void dropOldest();
+
+    std::vector<uint8_t> ring;
+    std::deque<Entry> entries;
+    size_t used;
+    uint32_t keyInterval;
+    size_t sinceKey; // frames pushed after the newest keyframe
+
+    std::vector<uint8_t> key; // state of the newest keyframe
+    std::vector<uint8_t> state; // scratch
+    std::vector<uint8_t> packed; // scratch
+};
+
+#endif
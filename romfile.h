@@ -0,0 +1,132 @@
+#ifndef CHIP8_ROMFILE_H
+#define CHIP8_ROMFILE_H
+
+// Read only view of a ROM file, mapped with mmap (read into a buffer on
+// Windows). open() checks the size against the program area before anything
+// is touched, so a ROM that does not fit is an error instead of a partial load
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include "chip8.h"
+#ifdef _WIN32
+#include <cstdio>
+#include <vector>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+class RomFile{
+public:
+    RomFile() : bytes(nullptr), length(0){}
+    ~RomFile(){ close(); }
+
+    RomFile(const RomFile&) = delete;
+    RomFile& operator=(const RomFile&) = delete;
+
+    // Returns false with the reason in error
+    bool open(const char* fileName, std::string& error);
+    void close();
+
+    const uint8_t* data() const{ return bytes; }
+    size_t size() const{ return length; }
+
+private:
+    static bool checkSize(const char* fileName, long long size, std::string& error){
+        if(size <= 0){
+            error = std::string(fileName) + ": empty ROM";
+            return false;
+        }
+        if(size > maxRomSize){
+            error = std::string(fileName) + ": " + std::to_string(size) + " bytes, more than the " +
+                    std::to_string(maxRomSize) + " that fit from 0x200";
+            return false;
+        }
+        return true;
+    }
+
+    const uint8_t* bytes;
+    size_t length;
+#ifdef _WIN32
+    std::vector<uint8_t> buffer;
+#endif
+};
+
+#ifdef _WIN32
+
+inline bool RomFile::open(const char* fileName, std::string& error){
+    close();
+    FILE* f = fopen(fileName, "rb");
+    if(!f){
+        error = std::string("could not open ") + fileName;
+        return false;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if(!checkSize(fileName, size, error)){
+        fclose(f);
+        return false;
+    }
+    buffer.resize(size);
+    bool read = fread(buffer.data(), 1, size, f) == (size_t)size;
+    fclose(f);
+    if(!read){
+        error = std::string("could not read ") + fileName;
+        buffer.clear();
+        return false;
+    }
+    bytes = buffer.data();
+    length = size;
+    return true;
+}
+
+inline void RomFile::close(){
+    buffer.clear();
+    bytes = nullptr;
+    length = 0;
+}
+
+#else
+
+inline bool RomFile::open(const char* fileName, std::string& error){
+    close();
+    int fd = ::open(fileName, O_RDONLY);
+    if(fd < 0){
+        error = std::string("could not open ") + fileName;
+        return false;
+    }
+    struct stat st;
+    if(fstat(fd, &st) || !S_ISREG(st.st_mode)){
+        ::close(fd);
+        error = std::string(fileName) + ": not a file";
+        return false;
+    }
+    if(!checkSize(fileName, st.st_size, error)){
+        ::close(fd);
+        return false;
+    }
+    // the mapping stays valid once the descriptor is gone
+    void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if(p == MAP_FAILED){
+        error = std::string("could not map ") + fileName;
+        return false;
+    }
+    bytes = static_cast<const uint8_t*>(p);
+    length = st.st_size;
+    return true;
+}
+
+inline void RomFile::close(){
+    if(bytes)
+        munmap(const_cast<uint8_t*>(bytes), length);
+    bytes = nullptr;
+    length = 0;
+}
+
+#endif
+
+#endif
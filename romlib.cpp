@@ -0,0 +1,97 @@
+#include "romlib.h"
+#include "romfile.h"
+#include "inputlog.h"
+#include <algorithm>
+#include <cstring>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <strings.h>
+#endif
+
+const RomEntry* RomLibrary::load(const char* fileName, std::string& error){
+    auto known = byPath.find(fileName);
+    if(known != byPath.end())
+        return known->second;
+
+    RomFile file;
+    if(!file.open(fileName, error))
+        return nullptr;
+    reads++;
+
+    const uint64_t hash = romHash(file.data(), file.size());
+    auto range = byHash.equal_range(hash);
+    for(auto it=range.first;it!=range.second;++it){
+        const RomEntry* e = it->second;
+        if(e->data.size() == file.size() && !memcmp(e->data.data(), file.data(), file.size())){
+            shared++;
+            byPath.emplace(fileName, e);
+            return e;
+        }
+    }
+
+    std::unique_ptr<RomEntry> e(new RomEntry);
+    e->name = fileName;
+    e->hash = hash;
+    e->data.assign(file.data(), file.data() + file.size());
+    e->image = new chip8;
+    e->image->loadProgram(file.data(), file.size());
+    e->code = new chip8::Code;
+    e->image->decodeAll(*e->code);
+
+    const RomEntry* entry = e.get();
+    entries.push_back(std::move(e));
+    byPath.emplace(fileName, entry);
+    byHash.emplace(hash, entry);
+    return entry;
+}
+
+static bool romExtension(const std::string& name){
+    static const char* const extensions[] = {".ch8", ".c8", ".rom"};
+    for(const char* ext : extensions){
+        size_t n = strlen(ext);
+        if(name.size() > n && !strcasecmp(name.c_str() + name.size() - n, ext))
+            return true;
+    }
+    return false;
+}
+
+bool listRoms(const char* dir, std::vector<std::string>& paths, std::string& error){
+    std::vector<std::string> names;
+#ifdef _WIN32
+    WIN32_FIND_DATAA found;
+    HANDLE h = FindFirstFileA((std::string(dir) + "\\*").c_str(), &found);
+    if(h == INVALID_HANDLE_VALUE){
+        error = std::string("could not open ") + dir;
+        return false;
+    }
+    do{
+        if(!(found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) && romExtension(found.cFileName))
+            names.push_back(found.cFileName);
+    }while(FindNextFileA(h, &found));
+    FindClose(h);
+#else
+    DIR* d = opendir(dir);
+    if(!d){
+        error = std::string("could not open ") + dir;
+        return false;
+    }
+    while(dirent* ent = readdir(d)){
+        if(romExtension(ent->d_name))
+            names.push_back(ent->d_name);
+    }
+    closedir(d);
+#endif
+    std::sort(names.begin(), names.end());
+
+    for(const std::string& name : names)
+        paths.push_back(std::string(dir) + "/" + name);
+    return true;
+}
+
+bool isDirectory(const char* name){
+    struct stat st;
+    return !stat(name, &st) && S_ISDIR(st.st_mode);
+}
@@ -0,0 +1,58 @@
+#ifndef CHIP8_ROMLIB_H
+#define CHIP8_ROMLIB_H
+
+// ROM cache for tools that start a lot of runs
+//
+// Every path is read once and entries are keyed by the hash of their
+// contents, so the same ROM under two names is stored once. An entry keeps
+// a chip8 with the ROM loaded and its decoding: copying the image over an
+// instance (it is trivially copyable, see pool.h) replaces loading the ROM
+// again, and every copy reads the entry's decode cache instead of its own. Not thread safe, load everything
+// before handing entries to the threads, entries live as long as the library
+#include <cstdint>
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "chip8.h"
+
+struct RomEntry{
+    std::string name; // the first path it was loaded from
+    uint64_t hash; // romHash() of the contents
+    std::vector<uint8_t> data;
+    chip8* image; // ROM loaded, reading its cache from code
+    chip8::Code* code;
+
+    RomEntry() : hash(0), image(nullptr), code(nullptr){}
+    ~RomEntry(){ delete image; delete code; }
+    RomEntry(const RomEntry&) = delete;
+    RomEntry& operator=(const RomEntry&) = delete;
+};
+
+class RomLibrary{
+public:
+    // The entry for fileName, nullptr with the reason in error
+    const RomEntry* load(const char* fileName, std::string& error);
+
+    size_t size() const{ return entries.size(); }
+    // files read, and how many of those turned out to be a ROM already held
+    size_t filesRead() const{ return reads; }
+    size_t duplicates() const{ return shared; }
+
+private:
+    std::vector<std::unique_ptr<RomEntry>> entries;
+    std::map<std::string, const RomEntry*> byPath;
+    std::unordered_multimap<uint64_t, const RomEntry*> byHash;
+    size_t reads = 0;
+    size_t shared = 0;
+};
+
+// True if name is a directory, for command lines taking either
+bool isDirectory(const char* name);
+// Paths of the .ch8, .c8 and .rom files in dir sorted by name, false with
+// the reason in error if dir can not be read
+bool listRoms(const char* dir, std::vector<std::string>& paths, std::string& error);
+
+#endif
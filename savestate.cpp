@@ -0,0 +1,109 @@
+#include "savestate.h"
+#include <cstring>
+#include <memory>
+
+namespace {
+
+const uint8_t magic[4] = {'C', '8', 'S', 'T'};
+const size_t headerSize = 8;
+
+// Every field of the blob in order, the same list writes and reads it
+template<typename State, typename Copy>
+void fields(State& c, Copy copy){
+    copy(c.memory, sizeof(c.memory));
+    copy(c.V, sizeof(c.V));
+    copy(&c.I, sizeof(c.I));
+    copy(&c.pc, sizeof(c.pc));
+    copy(c.stack, sizeof(c.stack));
+    copy(&c.sp, sizeof(c.sp));
+    copy(&c.opcode, sizeof(c.opcode));
+    copy(&c.delayTimer, sizeof(c.delayTimer));
+    copy(&c.soundTimer, sizeof(c.soundTimer));
+    copy(&c.timerPeriod, sizeof(c.timerPeriod));
+    copy(&c.variant, sizeof(c.variant));
+    copy(&c.timerPhase, sizeof(c.timerPhase));
+    copy(&c.rngState, sizeof(c.rngState));
+    copy(&c.cycles, sizeof(c.cycles));
+    copy(c.keypad, sizeof(c.keypad));
+    copy(c.gfx, sizeof(c.gfx));
+    copy(&c.dirtyPages, sizeof(c.dirtyPages));
+}
+
+size_t bodySize(){
+    static const size_t size = []{
+        size_t n = 0;
+        // only the sizes are looked at
+        std::unique_ptr<chip8> probe(new chip8);
+        fields(*probe, [&n](const void*, size_t len){ n += len; });
+        return n;
+    }();
+    return size;
+}
+
+}
+
+size_t stateSize(){
+    return headerSize + bodySize();
+}
+
+void saveState(const chip8& c, uint8_t* out){
+    const uint32_t version = CHIP8_STATE_VERSION;
+    memcpy(out, magic, sizeof(magic));
+    memcpy(out + 4, &version, sizeof(version));
+    uint8_t* p = out + headerSize;
+    fields(c, [&p](const void* field, size_t len){
+        memcpy(p, field, len);
+        p += len;
+    });
+}
+
+std::vector<uint8_t> saveState(const chip8& c){
+    std::vector<uint8_t> blob(stateSize());
+    saveState(c, blob.data());
+    return blob;
+}
+
+bool loadState(chip8& c, const uint8_t* data, size_t size){
+    uint32_t version;
+    if(size != stateSize() || memcmp(data, magic, sizeof(magic)))
+        return false;
+    memcpy(&version, data + 4, sizeof(version));
+    if(version != CHIP8_STATE_VERSION)
+        return false;
+
+    // a blob that would break the instance is refused before anything is
+    // assigned: variant indexes the handler tables, the timers divide by
+    // timerPeriod and call and return index stack with sp
+    chip8::Variant variant;
+    uint32_t timerPeriod;
+    uint16_t sp;
+    const uint8_t* p = data + headerSize;
+    fields(c, [&](void* field, size_t len){
+        if(field == &c.variant)
+            memcpy(&variant, p, sizeof(variant));
+        else if(field == &c.timerPeriod)
+            memcpy(&timerPeriod, p, sizeof(timerPeriod));
+        else if(field == &c.sp)
+            memcpy(&sp, p, sizeof(sp));
+        p += len;
+    });
+    if((unsigned)variant >= chip8::VARIANT_COUNT || timerPeriod == 0 ||
+       sp > sizeof(c.stack) / sizeof(c.stack[0]))
+        return false;
+
+    p = data + headerSize;
+    fields(c, [&p](void* field, size_t len){
+        memcpy(field, p, len);
+        p += len;
+    });
+
+    // the cache and anything translated were built from the old memory,
+    // the pages that match the shared decoding again go back to it
+    uint64_t dirtyPages = c.dirtyPages;
+    c.invalidate(0, sizeof(c.memory));
+    c.setCode(c.code);
+    c.dirtyPages = dirtyPages;
+    c.dirtyRows = 0xFFFFFFFF;
+    c.hashRows = 0xFFFFFFFF;
+    return true;
+}
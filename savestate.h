@@ -0,0 +1,29 @@
+#ifndef CHIP8_SAVESTATE_H
+#define CHIP8_SAVESTATE_H
+
+// Save states
+//
+// A state is a flat blob of stateSize() bytes: an 8 byte header (magic and
+// format version) followed by the machine state in a fixed order, in host
+// byte order. The decode cache and the counters are left out, restoring
+// throws the cache away and translated code (JIT) is told through the write
+// hook as if the whole of memory had been written.
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include "chip8.h"
+
+#define CHIP8_STATE_VERSION 2
+
+// Size of every blob of the current version
+size_t stateSize();
+
+// Writes stateSize() bytes to out
+void saveState(const chip8& c, uint8_t* out);
+std::vector<uint8_t> saveState(const chip8& c);
+
+// False if the blob is not a state of this version or holds a variant, timer
+// period or stack pointer the core can not run, c is left untouched then
+bool loadState(chip8& c, const uint8_t* data, size_t size);
+
+#endif
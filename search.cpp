@@ -0,0 +1,234 @@
+#include "search.h"
+#include "pool.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace {
+
+// Threads kept for the whole search. A round has two short phases and a
+// search hundreds of rounds, starting threads for each would cost about as
+// much as the forks, so run() wakes the same ones and hands out task
+// indices through a counter. The caller works as thread 0
+class Crew{
+public:
+    typedef std::function<void(unsigned thread, size_t task)> Task;
+
+    explicit Crew(unsigned count) : task(nullptr), count(0), next(0), generation(0), working(0), stopping(false){
+        for(unsigned t=1;t<count;t++)
+            threads.emplace_back(&Crew::loop, this, t);
+    }
+
+    ~Crew(){
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for(std::thread& t : threads)
+            t.join();
+    }
+
+    // Runs task(thread, i) for every i below n, returns once all are done
+    void run(size_t n, const Task& t){
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            task = &t;
+            count = n;
+            next = 0;
+            working = threads.size();
+            generation++;
+        }
+        wake.notify_all();
+        work(0);
+        std::unique_lock<std::mutex> guard(lock);
+        done.wait(guard, [&]{ return working == 0; });
+    }
+
+private:
+    void loop(unsigned self){
+        uint64_t seen = 0;
+        for(;;){
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                wake.wait(guard, [&]{ return stopping || generation != seen; });
+                if(stopping)
+                    return;
+                seen = generation;
+            }
+            work(self);
+            std::lock_guard<std::mutex> guard(lock);
+            if(--working == 0)
+                done.notify_one();
+        }
+    }
+
+    void work(unsigned self){
+        for(size_t i; (i = next.fetch_add(1)) < count;)
+            (*task)(self, i);
+    }
+
+    std::vector<std::thread> threads;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable done;
+    const Task* task;
+    size_t count;
+    std::atomic<size_t> next;
+    uint64_t generation;
+    size_t working;
+    bool stopping;
+};
+
+// The keypad for every frame of one child, from a generator seeded with
+// the search seed and the child's place in the tree
+void sequence(const SearchOptions& o, unsigned round, size_t parent, size_t child, uint16_t* frames){
+    uint8_t allowed[16];
+    int count = 0;
+    for(int k=0;k<16;k++){
+        if((o.keys >> k) & 1)
+            allowed[count++] = k;
+    }
+
+    uint64_t s = o.seed;
+    s = chip8::mix64(s ^ ((uint64_t)round << 32));
+    s = chip8::mix64(s ^ parent);
+    s = chip8::mix64(s ^ child);
+    uint32_t x = (uint32_t)(s ^ (s >> 32)) | 1;
+
+    const unsigned hold = std::max(o.hold, 1u);
+    uint16_t mask = 0;
+    for(unsigned f=0;f<o.frames;f++){
+        if(f % hold == 0){
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            // one of the allowed keys or none at all
+            const uint32_t pick = x % (count + 1);
+            mask = pick ? 1u << allowed[pick - 1] : 0;
+        }
+        frames[f] = mask;
+    }
+}
+
+void play(chip8& c, const SearchOptions& o, const uint16_t* frames){
+    for(unsigned f=0;f<o.frames;f++){
+        for(int k=0;k<16;k++)
+            c.keypad[k] = (frames[f] >> k) & 1;
+        c.run(o.instructionsPerFrame, o.engine);
+    }
+}
+
+}
+
+SearchResult search(const chip8& root, const SearchOptions& options, SearchScore score, void* ctx){
+    SearchResult result;
+    result.score = 0;
+    result.forks = 0;
+    result.seconds = 0;
+    const auto start = std::chrono::steady_clock::now();
+
+    const size_t beam = std::max(options.beam, 1u);
+    const size_t children = std::max(options.children, 1u);
+    unsigned threads = options.threads;
+    if(threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = std::min<size_t>(threads, beam * children);
+
+    // the beam, the next one being built and one instance per thread to fork into
+    InstancePool instancePool(2 * beam + threads);
+    std::vector<chip8*> current, upcoming, work;
+    for(size_t i=0;i<beam;i++){
+        current.push_back(instancePool.acquire());
+        upcoming.push_back(instancePool.acquire());
+    }
+    for(unsigned t=0;t<threads;t++)
+        work.push_back(instancePool.acquire());
+
+    // every fork reads its decode cache from one decoding of root
+    std::unique_ptr<chip8::Code> code(new chip8::Code);
+    current[0]->forkFrom(root);
+    current[0]->decodeAll(*code);
+    size_t live = 1;
+    std::vector<std::vector<uint16_t>> paths(1), nextPaths;
+
+    Crew crew(threads);
+    std::vector<double> scores;
+    std::vector<size_t> order;
+    std::vector<uint16_t> frames(options.frames);
+    std::vector<std::vector<uint16_t>> scratch(threads, frames);
+    for(unsigned round=0;round<options.rounds;round++){
+        const size_t tasks = live * children;
+        scores.resize(tasks);
+        crew.run(tasks, [&](unsigned thread, size_t i){
+            uint16_t* seq = scratch[thread].data();
+            sequence(options, round, i / children, i % children, seq);
+            chip8& c = *work[thread];
+            c.forkFrom(*current[i / children]);
+            play(c, options, seq);
+            scores[i] = score(ctx, c);
+        });
+        result.forks += tasks;
+
+        // best first, ties go to the earlier child so thread timing never matters
+        order.resize(tasks);
+        for(size_t i=0;i<tasks;i++)
+            order[i] = i;
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b){ return scores[a] > scores[b]; });
+        const size_t keep = std::min(beam, tasks);
+        result.score = scores[order[0]];
+
+        nextPaths.assign(keep, std::vector<uint16_t>());
+        for(size_t i=0;i<keep;i++){
+            const size_t parent = order[i] / children;
+            sequence(options, round, parent, order[i] % children, frames.data());
+            nextPaths[i] = paths[parent];
+            nextPaths[i].insert(nextPaths[i].end(), frames.begin(), frames.end());
+        }
+        paths.swap(nextPaths);
+
+        // the winners only live on in the work instances' past, replaying
+        // them from their parent is cheaper than having kept every child
+        if(round + 1 < options.rounds){
+            crew.run(keep, [&](unsigned, size_t i){
+                const size_t parent = order[i] / children;
+                const uint16_t* seq = paths[i].data() + paths[i].size() - options.frames;
+                upcoming[i]->forkFrom(*current[parent]);
+                play(*upcoming[i], options, seq);
+            });
+            current.swap(upcoming);
+            live = keep;
+        }
+    }
+    result.frames = paths[0];
+
+    for(chip8* c : current)
+        instancePool.release(c);
+    for(chip8* c : upcoming)
+        instancePool.release(c);
+    for(chip8* c : work)
+        instancePool.release(c);
+
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+std::vector<InputEvent> searchInput(const std::vector<uint16_t>& frames, uint64_t startCycle,
+                                    uint32_t instructionsPerFrame){
+    std::vector<InputEvent> events;
+    uint16_t held = 0;
+    for(size_t f=0;f<frames.size();f++){
+        const uint16_t changed = frames[f] ^ held;
+        for(int k=0;k<16;k++){
+            if((changed >> k) & 1)
+                events.push_back({startCycle + f * instructionsPerFrame, (uint8_t)k, (uint8_t)((frames[f] >> k) & 1)});
+        }
+        held = frames[f];
+    }
+    return events;
+}
@@ -0,0 +1,62 @@
+#ifndef CHIP8_SEARCH_H
+#define CHIP8_SEARCH_H
+
+// Beam search over keypad sequences, for automated playtesting
+//
+// Every round forks each instance in the beam into children, gives every
+// child its own random keypad sequence, runs it for a few frames and keeps
+// the best scoring children as the next beam. With a beam of one it is a
+// greedy Monte Carlo search. Forks are chip8::forkFrom() into one instance
+// per thread, so a fork costs a copy of the state without the decode cache
+// overlay rather than a constructor and loadProgram(), and all of them read
+// one decoding of the root. The winners of a round are rebuilt from their
+// parent and sequence at the start of the next one, which is all the state
+// the search keeps apart from the beam.
+//
+// Sequences only depend on the seed and where in the tree a child is, the
+// result is the same on any number of threads.
+#include <cstdint>
+#include <vector>
+#include "chip8.h"
+#include "inputlog.h"
+
+// Higher is better. Called from the search threads at once, each call with
+// a different child, so it must not write anything shared without locking
+typedef double (*SearchScore)(void* ctx, const chip8& c);
+
+struct SearchOptions{
+    unsigned beam; // instances carried from one round to the next
+    unsigned children; // forks of every beam instance per round
+    unsigned rounds;
+    unsigned frames; // frames every child runs
+    unsigned hold; // frames a key stays down (or none is) before the next pick
+    uint32_t instructionsPerFrame;
+    uint16_t keys; // bit k set if key k may be pressed, one key at a time
+    uint32_t seed;
+    unsigned threads; // 0 picks the core count
+    chip8::Engine engine;
+
+    SearchOptions()
+        : beam(8), children(32), rounds(16), frames(30), hold(5), instructionsPerFrame(10),
+          keys(0xFFFF), seed(0), threads(0), engine(CHIP8_DEFAULT_ENGINE){}
+};
+
+struct SearchResult{
+    double score; // of the best instance after the last round
+    // keypad for every frame from the root to that instance, bit k for key k
+    std::vector<uint16_t> frames;
+    uint64_t forks;
+    double seconds;
+};
+
+// Searches from root, which is left as it was. Every frame sets the whole
+// keypad, playing the frames it returns on root (see searchInput()) gives
+// the best instance found
+SearchResult search(const chip8& root, const SearchOptions& options, SearchScore score, void* ctx);
+
+// frames as input events for a run starting at startCycle with no key down,
+// to save as an input log or give runInput()
+std::vector<InputEvent> searchInput(const std::vector<uint16_t>& frames, uint64_t startCycle,
+                                    uint32_t instructionsPerFrame);
+
+#endif
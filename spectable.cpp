@@ -0,0 +1,68 @@
+// Specialized engine, a 65536 entry table of handlers with the operands known
+// at compile time so every handler folds down to a couple of instructions.
+// Only built for the Modern variant, one table per variant would multiply
+// the compile time, run() sends the others to the threaded engine
+#include "chip8.h"
+#include <array>
+#include <utility>
+
+namespace {
+
+// Which part of an opcode gets baked into its handler. x, y and nn are
+// template constants, nnn (1nnn, 2nnn, Annn, Bnnn) and the sprite height of
+// Dxyn are read back from opcode at run time, which keeps the number of
+// distinct handlers (and the compile time of this file) down
+constexpr uint16_t canon(uint16_t op){
+    switch(op >> 12){
+        case 0x0: return op & 0xF00F;
+        case 0x1: case 0x2: case 0xA: case 0xB: return op & 0xF000;
+        case 0x5: case 0x9: case 0xD: return op & 0xFFF0;
+        default: return op;
+    }
+}
+
+constexpr bool runtimeFields(uint16_t op){
+    return (op >> 12) == 0x1 || (op >> 12) == 0x2 || (op >> 12) == 0xA ||
+           (op >> 12) == 0xB || (op >> 12) == 0xD;
+}
+
+template<uint16_t K>
+void spec(chip8& c){
+    constexpr chip8::Instr k = chip8::makeInstr(K);
+    chip8::Instr in = runtimeFields(K) ? chip8::makeInstr(c.opcode) : k;
+    in.id = k.id;
+    c.exec<chip8::ModernQuirks>(in);
+}
+
+void specNull(chip8&){}
+
+// undefined opcodes all share specNull instead of instantiating a handler each
+template<uint16_t OP, bool Null = chip8::opId(OP) == chip8::OP_NULL>
+struct Pick{ static constexpr Chip8SpecFunc fn = &spec<canon(OP)>; };
+
+template<uint16_t OP>
+struct Pick<OP, true>{ static constexpr Chip8SpecFunc fn = &specNull; };
+
+template<size_t Hi, size_t... Lo>
+constexpr std::array<Chip8SpecFunc, 0x100> row(std::index_sequence<Lo...>){
+    return {{ Pick<(Hi << 8) | Lo>::fn... }};
+}
+
+template<size_t... Hi>
+constexpr Chip8SpecTable table(std::index_sequence<Hi...>){
+    return {{ row<Hi>(std::make_index_sequence<0x100>())... }};
+}
+
+}
+
+const Chip8SpecTable chip8_spectable = table(std::make_index_sequence<0x100>());
+
+void chip8::runSpecialized(uint64_t n){
+    for(uint64_t i=0;i<n;i++){
+        uint16_t op = (memory[pc & 0xFFF] << 8u) | memory[(pc + 1) & 0xFFF];
+        opcode = op;
+        pc += 2;
+        chip8_spectable[op >> 8][op & 0xFF](*this);
+        retire();
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef SPSCRING_H
+#define SPSCRING_H
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+// Lock free ring buffer for exactly one producer and one consumer thread
+//
+// push() and pop() never wait, they report a full or empty ring instead so
+// the caller decides what to drop. The capacity is rounded up to a power of
+// two so positions wrap with a mask.
+template<typename T>
+class SpscRing{
+public:
+    explicit SpscRing(size_t capacity) : head(0), tail(0){
+        size_t size = 1;
+        while(size < capacity)
+            size <<= 1;
+        slots.resize(size);
+        mask = size - 1;
+    }
+
+    size_t capacity() const { return slots.size(); }
+
+    // producer side, false when the ring is full
+    bool push(const T& value){
+        size_t h = head.load(std::memory_order_relaxed);
+        if(h - tail.load(std::memory_order_acquire) == slots.size())
+            return false;
+        slots[h & mask] = value;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer side, false when the ring is empty
+    bool pop(T& value){
+        size_t t = tail.load(std::memory_order_relaxed);
+        if(t == head.load(std::memory_order_acquire))
+            return false;
+        value = slots[t & mask];
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // entries waiting, exact on the consumer side and a lower bound elsewhere
+    size_t size() const {
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+    }
+
+private:
+    std::vector<T> slots;
+    size_t mask;
+    // written by one side each, kept on separate cache lines
+    alignas(64) std::atomic<size_t> head;
+    alignas(64) std::atomic<size_t> tail;
+};
+
+#endif
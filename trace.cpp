@@ -0,0 +1,474 @@
+#include "trace.h"
+#include <chrono>
+#include <cstring>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+const char magic[4] = {'C', '8', 'T', 'R'};
+const size_t headerSize = 4 + 4 + 1 + 8 + 2 + 2 + 2 + 16;
+
+// a buffer goes to the writer once it has this much, records are a few bytes
+const size_t bufferSize = 1 << 20;
+const size_t bufferCount = 4;
+
+uint64_t get(const uint8_t* p, int bytes){
+    uint64_t v = 0;
+    for(int i=0;i<bytes;i++)
+        v |= (uint64_t)p[i] << (8 * i);
+    return v;
+}
+
+}
+
+Tracer::Tracer()
+    : c(nullptr), chainedHook(nullptr), chainedCtx(nullptr),
+      full(bufferCount), empty(bufferCount), current(nullptr),
+      done(false), failed(false), file(nullptr), recordCount(0), byteCount(0){
+}
+
+Tracer::~Tracer(){
+    finish();
+}
+
+bool Tracer::start(const char* fileName, chip8& target, std::string& error){
+    finish();
+    file = fopen(fileName, "wb");
+    if(!file){
+        error = std::string("could not create ") + fileName;
+        return false;
+    }
+
+    c = &target;
+    memcpy(V, c->V, sizeof(V));
+    I = c->I;
+    sp = c->sp;
+    lastPc = c->pc - 2; // the first record is expected at pc
+    nextCycle = c->cycles;
+    for(uint32_t& s : seen)
+        s = 0x10000;
+    writes.clear();
+    recordCount = 0;
+    byteCount = 0;
+
+    chainedHook = c->writeHook;
+    chainedCtx = c->writeHookCtx;
+    c->writeHook = &Tracer::onWrite;
+    c->writeHookCtx = this;
+
+    buffers.assign(bufferCount, std::vector<uint8_t>());
+    for(std::vector<uint8_t>& b : buffers)
+        b.reserve(bufferSize + 256);
+    current = &buffers[0];
+    for(size_t i=1;i<bufferCount;i++)
+        empty.push(&buffers[i]);
+    done = false;
+    failed = false;
+    thread = std::thread(&Tracer::writer, this);
+
+    for(char m : magic)
+        put((uint8_t)m);
+    for(int i=0;i<4;i++)
+        put((uint8_t)(CHIP8_TRACE_VERSION >> (8 * i)));
+    put((uint8_t)c->variant);
+    for(int i=0;i<8;i++)
+        put((uint8_t)(c->cycles >> (8 * i)));
+    put((uint8_t)c->pc);
+    put((uint8_t)(c->pc >> 8));
+    put((uint8_t)I);
+    put((uint8_t)(I >> 8));
+    put((uint8_t)sp);
+    put((uint8_t)(sp >> 8));
+    for(uint8_t v : V)
+        put(v);
+    return true;
+}
+
+bool Tracer::finish(){
+    if(!file)
+        return true;
+    if(c && c->writeHookCtx == this){
+        c->writeHook = chainedHook;
+        c->writeHookCtx = chainedCtx;
+    }
+    c = nullptr;
+
+    if(!current->empty())
+        full.push(current);
+    current = nullptr;
+    done = true;
+    thread.join();
+    // drop whatever an early exit of the writer left queued
+    std::vector<uint8_t>* b;
+    while(full.pop(b)){}
+    while(empty.pop(b)){}
+
+    bool ok = !failed && !ferror(file);
+    ok = fclose(file) == 0 && ok;
+    file = nullptr;
+    return ok;
+}
+
+void Tracer::onWrite(void* ctx, uint16_t addr, uint16_t len){
+    Tracer* t = (Tracer*)ctx;
+    t->writes.push_back(Write{addr, len});
+    if(t->chainedHook)
+        t->chainedHook(t->chainedCtx, addr, len);
+}
+
+void Tracer::run(uint64_t n){
+    for(uint64_t i=0;i<n;i++){
+        const uint16_t at = c->pc;
+        const uint64_t before = c->cycles;
+        c->emulateCycle();
+        record(at, before);
+    }
+}
+
+void Tracer::record(uint16_t at, uint64_t before){
+    const uint16_t op = c->opcode;
+    uint8_t flags = 0;
+    uint64_t gap = before - nextCycle;
+    if(gap)
+        flags |= TRACE_GAP;
+    if(at != (uint16_t)(lastPc + 2))
+        flags |= TRACE_PC;
+    if(seen[at & 0xFFF] != op)
+        flags |= TRACE_OPCODE;
+
+    uint16_t changed = 0;
+    int count = 0, only = 0;
+    for(int r=0;r<16;r++){
+        if(c->V[r] != V[r]){
+            changed |= 1 << r;
+            count++;
+            only = r;
+        }
+    }
+    if(count == 1)
+        flags |= TRACE_V1;
+    else if(count)
+        flags |= TRACE_VN;
+    if(c->I != I)
+        flags |= TRACE_I;
+    if(c->sp != sp)
+        flags |= TRACE_SP;
+    if(!writes.empty())
+        flags |= TRACE_MEM;
+
+    put(flags);
+    if(flags & TRACE_GAP)
+        putCount(gap);
+    if(flags & TRACE_PC){
+        int64_t d = (int64_t)at - (int64_t)(uint16_t)(lastPc + 2);
+        putCount(((uint64_t)d << 1) ^ (uint64_t)(d >> 63));
+    }
+    if(flags & TRACE_OPCODE){
+        put((uint8_t)op);
+        put((uint8_t)(op >> 8));
+        seen[at & 0xFFF] = op;
+    }
+    if(flags & TRACE_V1){
+        put((uint8_t)only);
+        put(c->V[only]);
+    }
+    else if(flags & TRACE_VN){
+        put((uint8_t)changed);
+        put((uint8_t)(changed >> 8));
+        for(int r=0;r<16;r++){
+            if(changed & (1 << r))
+                put(c->V[r]);
+        }
+    }
+    if(flags & TRACE_I){
+        put((uint8_t)c->I);
+        put((uint8_t)(c->I >> 8));
+    }
+    if(flags & TRACE_SP){
+        put((uint8_t)c->sp);
+        put((uint8_t)(c->sp >> 8));
+    }
+    if(flags & TRACE_MEM){
+        putCount(writes.size());
+        for(const Write& w : writes){
+            put((uint8_t)w.addr);
+            put((uint8_t)(w.addr >> 8));
+            putCount(w.len);
+            for(uint16_t k=0;k<w.len;k++)
+                put(c->memory[(w.addr + k) & 0xFFF]);
+        }
+        writes.clear();
+    }
+
+    memcpy(V, c->V, sizeof(V));
+    I = c->I;
+    sp = c->sp;
+    lastPc = at;
+    nextCycle = before + 1;
+    recordCount++;
+    if(current->size() >= bufferSize)
+        flush();
+}
+
+void Tracer::put(uint8_t b){
+    current->push_back(b);
+    byteCount++;
+}
+
+void Tracer::putCount(uint64_t n){
+    while(n >= 0x80){
+        put((uint8_t)(n | 0x80));
+        n >>= 7;
+    }
+    put((uint8_t)n);
+}
+
+// Hands the current buffer to the writer and takes an empty one, waiting
+// only when the writer has not caught up with any of them
+void Tracer::flush(){
+    full.push(current);
+    while(!empty.pop(current))
+        std::this_thread::yield();
+}
+
+void Tracer::writer(){
+    for(;;){
+        std::vector<uint8_t>* b;
+        if(full.pop(b)){
+            if(!failed && fwrite(b->data(), 1, b->size(), file) != b->size())
+                failed = true;
+            b->clear();
+            empty.push(b);
+            continue;
+        }
+        if(done && !full.size())
+            break;
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+}
+
+TraceReader::TraceReader()
+    : variant(chip8::Variant::Modern), startCycle(0), truncated(false),
+      bytes(nullptr), length(0), pos(0){
+}
+
+TraceReader::~TraceReader(){
+    close();
+}
+
+#ifdef _WIN32
+
+static bool mapTrace(const char* fileName, std::vector<uint8_t>& buffer, const uint8_t*& bytes,
+                     size_t& length, std::string& error){
+    FILE* f = fopen(fileName, "rb");
+    if(!f){
+        error = std::string("could not open ") + fileName;
+        return false;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    buffer.resize(size > 0 ? size : 0);
+    bool read = fread(buffer.data(), 1, buffer.size(), f) == buffer.size();
+    fclose(f);
+    if(!read){
+        error = std::string("could not read ") + fileName;
+        return false;
+    }
+    bytes = buffer.data();
+    length = buffer.size();
+    return true;
+}
+
+void TraceReader::close(){
+    buffer.clear();
+    bytes = nullptr;
+    length = 0;
+}
+
+#else
+
+void TraceReader::close(){
+    if(bytes && length)
+        munmap(const_cast<uint8_t*>(bytes), length);
+    bytes = nullptr;
+    length = 0;
+}
+
+#endif
+
+bool TraceReader::open(const char* fileName, std::string& error){
+    close();
+#ifdef _WIN32
+    if(!mapTrace(fileName, buffer, bytes, length, error))
+        return false;
+#else
+    int fd = ::open(fileName, O_RDONLY);
+    if(fd < 0){
+        error = std::string("could not open ") + fileName;
+        return false;
+    }
+    struct stat st;
+    if(fstat(fd, &st) || !S_ISREG(st.st_mode)){
+        ::close(fd);
+        error = std::string(fileName) + ": not a file";
+        return false;
+    }
+    if(st.st_size < (off_t)headerSize){
+        ::close(fd);
+        error = std::string(fileName) + ": not a trace";
+        return false;
+    }
+    void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if(p == MAP_FAILED){
+        error = std::string("could not map ") + fileName;
+        return false;
+    }
+    bytes = static_cast<const uint8_t*>(p);
+    length = st.st_size;
+#endif
+
+    if(length < headerSize || memcmp(bytes, magic, sizeof(magic))){
+        close();
+        error = std::string(fileName) + ": not a trace";
+        return false;
+    }
+    if(get(bytes + 4, 4) != CHIP8_TRACE_VERSION){
+        close();
+        error = std::string(fileName) + ": unsupported trace version";
+        return false;
+    }
+    if(bytes[8] >= chip8::VARIANT_COUNT){
+        close();
+        error = std::string(fileName) + ": unknown variant";
+        return false;
+    }
+    variant = (chip8::Variant)bytes[8];
+    startCycle = get(bytes + 9, 8);
+    pc = (uint16_t)get(bytes + 17, 2);
+    I = (uint16_t)get(bytes + 19, 2);
+    sp = (uint16_t)get(bytes + 21, 2);
+    memcpy(V, bytes + 23, sizeof(V));
+    pos = headerSize;
+
+    cycle = startCycle;
+    pc -= 2;
+    for(uint32_t& s : seen)
+        s = 0x10000;
+    first = true;
+    truncated = false;
+    return true;
+}
+
+bool TraceReader::next(TraceRecord& r){
+    if(pos >= length)
+        return false;
+    size_t at = pos;
+    auto byte = [&](uint8_t& b){
+        if(at >= length)
+            return false;
+        b = bytes[at++];
+        return true;
+    };
+    auto count = [&](uint64_t& n){
+        n = 0;
+        for(int shift=0;shift<64;shift+=7){
+            uint8_t b;
+            if(!byte(b))
+                return false;
+            n |= (uint64_t)(b & 0x7F) << shift;
+            if(!(b & 0x80))
+                return true;
+        }
+        return false;
+    };
+    auto word = [&](uint16_t& w){
+        uint8_t lo, hi;
+        if(!byte(lo) || !byte(hi))
+            return false;
+        w = lo | (hi << 8);
+        return true;
+    };
+
+    // nothing below touches the reader until the whole record decoded
+    uint8_t flags;
+    uint64_t gap = 0, delta = 0;
+    bool ok = byte(flags);
+    if(ok && (flags & TRACE_GAP))
+        ok = count(gap);
+    if(ok && (flags & TRACE_PC))
+        ok = count(delta);
+    const uint16_t recordPc = (uint16_t)(pc + 2 + (int64_t)((delta >> 1) ^ (0 - (delta & 1))));
+    uint16_t op = (uint16_t)seen[recordPc & 0xFFF];
+    if(ok && (flags & TRACE_OPCODE))
+        ok = word(op);
+    else if(ok && seen[recordPc & 0xFFF] > 0xFFFF)
+        ok = false; // no opcode on record for this pc, not a trace this writer made
+
+    memcpy(r.oldV, V, sizeof(V));
+    memcpy(r.V, V, sizeof(V));
+    r.vChanged = 0;
+    if(ok && (flags & TRACE_V1)){
+        uint8_t reg, value;
+        ok = byte(reg) && byte(value) && reg < 16;
+        if(ok){
+            r.V[reg] = value;
+            r.vChanged = 1 << reg;
+        }
+    }
+    else if(ok && (flags & TRACE_VN)){
+        ok = word(r.vChanged);
+        for(int reg=0;ok && reg<16;reg++){
+            if(r.vChanged & (1 << reg))
+                ok = byte(r.V[reg]);
+        }
+    }
+    r.oldI = r.I = I;
+    if(ok && (flags & TRACE_I))
+        ok = word(r.I);
+    r.oldSp = r.sp = sp;
+    if(ok && (flags & TRACE_SP))
+        ok = word(r.sp);
+    r.writes.clear();
+    if(ok && (flags & TRACE_MEM)){
+        uint64_t n;
+        ok = count(n);
+        for(uint64_t i=0;ok && i<n;i++){
+            TraceRecord::Write w;
+            uint64_t len;
+            ok = word(w.addr) && count(len) && len <= length - at;
+            if(ok){
+                w.len = (uint16_t)len;
+                w.bytes = bytes + at;
+                at += len;
+                r.writes.push_back(w);
+            }
+        }
+    }
+    if(!ok){
+        truncated = true;
+        pos = length;
+        return false;
+    }
+
+    cycle += (first ? 0 : 1) + gap;
+    first = false;
+    r.cycle = cycle;
+    r.gap = gap;
+    r.pc = recordPc;
+    r.opcode = op;
+    r.flags = flags;
+    seen[recordPc & 0xFFF] = op;
+    pc = recordPc;
+    memcpy(V, r.V, sizeof(V));
+    I = r.I;
+    sp = r.sp;
+    pos = at;
+    return true;
+}
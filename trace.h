@@ -0,0 +1,168 @@
+#ifndef CHIP8_TRACE_H
+#define CHIP8_TRACE_H
+
+// Execution traces, one record per instruction with what it changed
+//
+// Tracer::run() steps an instance one emulateCycle() at a time, compares
+// V, I and sp against the previous record and catches memory writes through
+// writeHook (chained, so a JIT attached before keeps getting them). Records
+// are packed into buffers that a background thread writes out, the
+// emulation only waits on the disk when every buffer is full.
+//
+// File layout, little endian: "C8TR", version (32 bits), variant (8),
+// cycles (64), pc (16), I (16), sp (16), V0-VF as the state before the first
+// record, then one record per instruction:
+//   flags byte, then the fields it says are present in this order
+//   TRACE_GAP     instructions run untraced before this one, varint
+//   TRACE_PC      pc - (previous pc + 2) zigzagged, varint. Absent when the
+//                 instruction follows the previous one
+//   TRACE_OPCODE  opcode, 16 bits. Absent when it is what the last record
+//                 at this pc ran
+//   TRACE_V1      one V register changed: register, new value
+//   TRACE_VN      several changed: 16 bit mask, new values in register order
+//   TRACE_I       new I, 16 bits
+//   TRACE_SP      new sp, 16 bits (it runs off the stack both ways)
+//   TRACE_MEM     memory writes: varint count, then per write the address
+//                 (16 bits), varint length and the bytes written
+// Most instructions come out at one to three bytes.
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+#include "chip8.h"
+#include "spscring.h"
+
+#define CHIP8_TRACE_VERSION 2
+
+enum TraceFlags : uint8_t {
+    TRACE_PC = 0x01,
+    TRACE_OPCODE = 0x02,
+    TRACE_V1 = 0x04,
+    TRACE_VN = 0x08,
+    TRACE_I = 0x10,
+    TRACE_SP = 0x20,
+    TRACE_MEM = 0x40,
+    TRACE_GAP = 0x80
+};
+
+class Tracer{
+public:
+    Tracer();
+    ~Tracer();
+
+    Tracer(const Tracer&) = delete;
+    Tracer& operator=(const Tracer&) = delete;
+
+    // Creates the file and writes the header from c's current state.
+    // Returns false with the reason in error
+    bool start(const char* fileName, chip8& c, std::string& error);
+    // Runs exactly n instructions on the attached instance, recording each
+    void run(uint64_t n);
+    // Writes out what is left and closes the file, false if any write failed
+    bool finish();
+
+    uint64_t records() const{ return recordCount; }
+    uint64_t bytes() const{ return byteCount; }
+
+private:
+    struct Write{
+        uint16_t addr;
+        uint16_t len;
+    };
+
+    static void onWrite(void* ctx, uint16_t addr, uint16_t len);
+    void record(uint16_t at, uint64_t before);
+    void put(uint8_t b);
+    void putCount(uint64_t n);
+    void flush();
+    void writer();
+
+    chip8* c;
+    chip8::WriteHook chainedHook;
+    void* chainedCtx;
+
+    // state as of the last record
+    uint8_t V[16];
+    uint16_t I;
+    uint16_t sp;
+    uint16_t lastPc;
+    uint64_t nextCycle;
+    uint32_t seen[4096]; // opcode last recorded per pc, above 0xFFFF for none
+    std::vector<Write> writes; // made by the instruction being run
+
+    // buffers go out to the writer thread through full and come back
+    // through empty, so neither side ever takes a lock
+    std::vector<std::vector<uint8_t>> buffers;
+    SpscRing<std::vector<uint8_t>*> full;
+    SpscRing<std::vector<uint8_t>*> empty;
+    std::vector<uint8_t>* current;
+    std::thread thread;
+    std::atomic<bool> done;
+    std::atomic<bool> failed;
+    FILE* file;
+
+    uint64_t recordCount;
+    uint64_t byteCount;
+};
+
+// One decoded record, the registers as they are after it
+struct TraceRecord{
+    uint64_t cycle;
+    uint64_t gap; // instructions run untraced just before
+    uint16_t pc;
+    uint16_t opcode;
+    uint8_t flags;
+    uint16_t vChanged; // mask of V registers the record set
+    uint8_t V[16];
+    uint8_t oldV[16]; // before the record
+    uint16_t I, oldI;
+    uint16_t sp, oldSp;
+    struct Write{
+        uint16_t addr;
+        uint16_t len;
+        const uint8_t* bytes; // into the mapped file
+    };
+    std::vector<Write> writes;
+};
+
+// Reads a trace from a memory mapped file, record by record
+class TraceReader{
+public:
+    TraceReader();
+    ~TraceReader();
+
+    TraceReader(const TraceReader&) = delete;
+    TraceReader& operator=(const TraceReader&) = delete;
+
+    // Returns false with the reason in error
+    bool open(const char* fileName, std::string& error);
+    void close();
+
+    // Decodes the next record into r, false at the end. A record cut off
+    // by the end of the file (the writer died) ends the trace and sets truncated
+    bool next(TraceRecord& r);
+
+    chip8::Variant variant;
+    uint64_t startCycle;
+    bool truncated;
+    size_t fileSize() const{ return length; }
+
+private:
+    const uint8_t* bytes;
+    size_t length;
+    size_t pos;
+#ifdef _WIN32
+    std::vector<uint8_t> buffer;
+#endif
+
+    uint64_t cycle;
+    uint16_t pc, I, sp;
+    uint8_t V[16];
+    uint32_t seen[4096];
+    bool first;
+};
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef TRIPLEBUFFER_H
+#define TRIPLEBUFFER_H
+
+#include <atomic>
+#include <cstdint>
+
+// Lock free hand off between one producer and one consumer thread
+//
+// The producer always has a slot of its own to write (writeBuffer), publish()
+// swaps it with the shared middle slot. The consumer calls update() to swap
+// its slot with the middle one if something new was published since, and
+// reads readBuffer(). Neither side ever waits on the other, frames the
+// consumer was too slow to pick up are simply overwritten by newer ones.
+template<typename T>
+class TripleBuffer{
+public:
+    TripleBuffer() : back(0), middle(1), front(2) {}
+
+    T& writeBuffer(){ return slots[back]; }
+
+    void publish(){
+        back = middle.exchange(back | fresh, std::memory_order_acq_rel) & indexMask;
+    }
+
+    // true when readBuffer() now holds a frame it did not hold before
+    bool update(){
+        if(!(middle.load(std::memory_order_relaxed) & fresh))
+            return false;
+        front = middle.exchange(front, std::memory_order_acq_rel) & indexMask;
+        return true;
+    }
+
+    const T& readBuffer() const { return slots[front]; }
+
+private:
+    static const uint8_t indexMask = 0x3;
+    static const uint8_t fresh = 0x4; // set in middle by publish(), cleared by update()
+
+    T slots[3];
+    // each side only touches its own index, middle is the one they trade
+    alignas(64) uint8_t back;
+    alignas(64) std::atomic<uint8_t> middle;
+    alignas(64) uint8_t front;
+};
+
+#endif